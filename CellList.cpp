@@ -0,0 +1,132 @@
+﻿#include "CellList.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+// Points per chunk for the linear passes over all points
+const size_t CELL_LIST_PER_CHUNK = 16384;
+
+// Upper bound of cells per point; sparse systems get wider cells instead of mostly empty ones
+const double MAX_CELLS_PER_POINT = 2.0;
+
+void CellList::Build(ThreadPool& pool, const PointBuffer& points, float cutoff)
+{
+	if (!(cutoff > 0.0f))
+	{
+		throw std::invalid_argument("Cell list needs a positive cutoff");
+	}
+
+	size_t count = points.Count();
+
+	// Bounding box, reduced per worker
+	std::vector<std::array<float, 6>> bounds(pool.ThreadCount(), {
+		std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max(),
+		std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest()
+	});
+	pool.ParallelFor(count, CELL_LIST_PER_CHUNK, [&](size_t begin, size_t end, size_t worker)
+		{
+			auto& box = bounds[worker];
+			for (size_t index = begin; index < end; ++index)
+			{
+				for (int c = 0; c < 3; ++c)
+				{
+					box[c] = std::min(box[c], points.At(index, c));
+					box[c + 3] = std::max(box[c + 3], points.At(index, c));
+				}
+			}
+		});
+
+	float lower[3] = { 0.0f, 0.0f, 0.0f };
+	float upper[3] = { 0.0f, 0.0f, 0.0f };
+	if (count)
+	{
+		for (int c = 0; c < 3; ++c)
+		{
+			lower[c] = std::numeric_limits<float>::max();
+			upper[c] = std::numeric_limits<float>::lowest();
+			for (const auto& box : bounds)
+			{
+				lower[c] = std::min(lower[c], box[c]);
+				upper[c] = std::max(upper[c], box[c + 3]);
+			}
+		}
+	}
+
+	// Grid dimensions: cells of cutoff size, widened while there are too many of them
+	double maxCells = std::max(1.0, MAX_CELLS_PER_POINT * static_cast<double>(count));
+	double cellSize = cutoff;
+	for (;;)
+	{
+		double cells = 1.0;
+		for (int c = 0; c < 3; ++c)
+		{
+			cells *= std::floor((static_cast<double>(upper[c]) - lower[c]) / cellSize) + 1.0;
+		}
+		if (cells <= maxCells) break;
+		cellSize *= std::max(1.01, std::cbrt(cells / maxCells));
+	}
+
+	m_cellSize = static_cast<float>(cellSize);
+	for (int c = 0; c < 3; ++c)
+	{
+		m_origin[c] = lower[c];
+		m_dimensions[c] = static_cast<size_t>(std::floor((static_cast<double>(upper[c]) - lower[c]) / cellSize)) + 1;
+	}
+
+	// Cell of every point
+	m_cellOfPoint.resize(count);
+	pool.ParallelFor(count, CELL_LIST_PER_CHUNK, [&](size_t begin, size_t end, size_t)
+		{
+			for (size_t index = begin; index < end; ++index)
+			{
+				size_t cell[3];
+				for (int c = 0; c < 3; ++c)
+				{
+					double offset = (static_cast<double>(points.At(index, c)) - m_origin[c]) / cellSize;
+					cell[c] = std::min(m_dimensions[c] - 1, static_cast<size_t>(std::max(0.0, offset)));
+				}
+				m_cellOfPoint[index] = Cell(cell[0], cell[1], cell[2]);
+			}
+		});
+
+	// Counting sort; stable, so the order inside a cell does not depend on the thread count
+	size_t cells = m_dimensions[0] * m_dimensions[1] * m_dimensions[2];
+	m_cellStart.assign(cells + 1, 0);
+	for (size_t index = 0; index < count; ++index)
+	{
+		++m_cellStart[m_cellOfPoint[index] + 1];
+	}
+	for (size_t cell = 0; cell < cells; ++cell)
+	{
+		m_cellStart[cell + 1] += m_cellStart[cell];
+	}
+
+	m_sortedIndex.resize(count);
+	std::vector<size_t> next(m_cellStart.begin(), m_cellStart.end() - 1);
+	for (size_t index = 0; index < count; ++index)
+	{
+		m_sortedIndex[next[m_cellOfPoint[index]]++] = index;
+	}
+
+	// Sorted positions, streamed by the force kernels
+	m_x.resize(count);
+	m_y.resize(count);
+	m_z.resize(count);
+	pool.ParallelFor(count, CELL_LIST_PER_CHUNK, [&](size_t begin, size_t end, size_t)
+		{
+			for (size_t sorted = begin; sorted < end; ++sorted)
+			{
+				size_t index = m_sortedIndex[sorted];
+				m_x[sorted] = points.At(index, 0);
+				m_y[sorted] = points.At(index, 1);
+				m_z[sorted] = points.At(index, 2);
+			}
+		});
+}
+
+PositionStream CellList::SortedPositions() const
+{
+	return { m_x.data(), m_y.data(), m_z.data(), std::max<size_t>(1, m_x.size()), 0 };
+}
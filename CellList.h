@@ -0,0 +1,49 @@
+﻿#pragma once
+
+#include "CpuForceKernels.h"
+#include "PointBuffer.h"
+#include "ThreadPool.h"
+
+#include <array>
+#include <cstddef>
+#include <vector>
+
+// Uniform grid of cubic cells at least cutoff wide over the bounding box of the points.
+// Points are binned with a counting sort, so the points of a cell are contiguous in sorted
+// order and every pair closer than cutoff lies in the same or in neighboring cells.
+class CellList
+{
+public:
+	// Rebins all points; cells grow beyond cutoff only to keep the cell count near the point count
+	void Build(ThreadPool& pool, const PointBuffer& points, float cutoff);
+
+	size_t CellCount() const { return m_cellStart.empty() ? 0 : m_cellStart.size() - 1; }
+	const std::array<size_t, 3>& Dimensions() const { return m_dimensions; }
+	float CellSize() const { return m_cellSize; }
+
+	size_t Cell(size_t x, size_t y, size_t z) const
+	{
+		return x + m_dimensions[0] * (y + m_dimensions[1] * z);
+	}
+
+	// Points of a cell are [CellBegin(cell), CellBegin(cell + 1)) in sorted order
+	size_t CellBegin(size_t cell) const { return m_cellStart[cell]; }
+
+	// Original index of the point at a sorted position
+	size_t SortedIndex(size_t sorted) const { return m_sortedIndex[sorted]; }
+
+	// Positions in sorted order as one structure-of-arrays block
+	PositionStream SortedPositions() const;
+
+private:
+	float m_origin[3] = {};
+	float m_cellSize = 0.0f;
+	std::array<size_t, 3> m_dimensions = {};
+
+	std::vector<size_t> m_cellOfPoint;
+	std::vector<size_t> m_cellStart;
+	std::vector<size_t> m_sortedIndex;
+	std::vector<float> m_x;
+	std::vector<float> m_y;
+	std::vector<float> m_z;
+};
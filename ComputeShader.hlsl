@@ -7,26 +7,44 @@ struct Point
 StructuredBuffer<Point> pointsIn : register(t0);
 RWStructuredBuffer<Point> pointsOut : register(u0);
 
-static const float k = 0.01f;
-static const float m = 1.0f;
-static const float r0 = 0.2f;
-static const float dt = 0.01f;
+// Simulation parameters, see SimulationParameters in Simulation.h
+cbuffer Parameters : register(b0)
+{
+    float k;
+    float m;
+    float r0;
+    float dt;
+};
+
+// Mass of every point; when no buffer is bound every point has mass m
+StructuredBuffer<float> masses : register(t1);
+
+// Thread groups, see COMPUTE_GROUP_SIZE and COMPUTE_GROUPS_PER_ROW in Simulation.h
+static const uint groupSize = 64;
+static const uint groupsPerRow = 65535;
 
 float calcForce(float r)
 {
     return k * (r - r0);
 }
 
-[numthreads(1, 1, 1)]
-void CSMain(uint3 dispatchID : SV_DispatchThreadID)
+[numthreads(groupSize, 1, 1)]
+void CSMain(uint3 groupID : SV_GroupID, uint3 groupThreadID : SV_GroupThreadID)
 {
-    uint index = dispatchID.x;
-    Point p = pointsIn[index];
+    uint index = (groupID.y * groupsPerRow + groupID.x) * groupSize + groupThreadID.x;
 
     uint numStructs;
     uint stride;
 
     pointsIn.GetDimensions(numStructs, stride);
+
+    // The last group and the last row are only partly used
+    if (index >= numStructs)
+    {
+        return;
+    }
+
+    Point p = pointsIn[index];
     
     float3 totalForce = float3(0, 0, 0);
     for (uint i = 0; i < numStructs; i++)
@@ -44,7 +62,12 @@ void CSMain(uint3 dispatchID : SV_DispatchThreadID)
         }
     }
 
-    float3 totalAcceleration = totalForce / m;
+    // An unbound buffer has no elements
+    uint massCount;
+    masses.GetDimensions(massCount, stride);
+    float mass = massCount > 0 ? masses[index] : m;
+
+    float3 totalAcceleration = totalForce / mass;
     p.position += p.velocity * dt;
     p.velocity += totalAcceleration * dt;
 
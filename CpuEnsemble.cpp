@@ -0,0 +1,117 @@
+﻿#include "CpuEnsemble.h"
+
+#include <cfloat>
+#include <stdexcept>
+
+// Lane groups per chunk: a group of 10 points takes about a microsecond per step
+const size_t ENSEMBLE_GROUPS_PER_CHUNK = 4;
+
+CpuEnsemble::CpuEnsemble(ThreadPool& pool, const std::vector<std::vector<Point>>& systems,
+	const std::vector<SimulationParameters>& parameters, const ForceKernel* kernel, float cutoff)
+	: m_pool(pool)
+	, m_kernel(kernel ? kernel : &BestForceKernel())
+	, m_pair{ 0.0f, 0.0f, cutoff > 0.0f ? cutoff : FLT_MAX, {} }
+	, m_systemCount(systems.size())
+	, m_pointCount(systems.empty() ? 0 : systems.front().size())
+	, m_groupCount((systems.size() + m_kernel->width - 1) / m_kernel->width)
+{
+	if (parameters.size() != 1 && parameters.size() != systems.size())
+	{
+		throw std::invalid_argument("An ensemble needs one set of parameters, or one per system");
+	}
+	for (const auto& system : systems)
+	{
+		if (system.size() != m_pointCount)
+		{
+			throw std::invalid_argument("Every system of an ensemble needs the same point count");
+		}
+	}
+
+	size_t lanes = m_groupCount * m_kernel->width;
+	m_state.resize(lanes * m_pointCount * ENSEMBLE_COMPONENTS);
+	m_scratch.resize(m_state.size());
+
+	// Padding lanes stay at rest: no spring and unit mass
+	m_springK.assign(lanes, 0.0f);
+	m_restLength.assign(lanes, 0.0f);
+	m_timeStep.assign(lanes, 0.0f);
+	m_mass.assign(lanes, 1.0f);
+
+	for (size_t system = 0; system < m_systemCount; ++system)
+	{
+		const SimulationParameters& own = parameters.size() == 1 ? parameters.front() : parameters[system];
+		m_springK[system] = own.springK;
+		m_restLength[system] = own.restLength;
+		m_timeStep[system] = own.timeStep;
+		m_mass[system] = own.mass;
+
+		for (size_t i = 0; i < m_pointCount; ++i)
+		{
+			const Point& point = systems[system][i];
+			for (size_t c = 0; c < 3; ++c)
+			{
+				m_state[Offset(system, i, c)] = point.position[c];
+				m_state[Offset(system, i, c + 3)] = point.velocity[c];
+			}
+		}
+	}
+}
+
+void CpuEnsemble::RunCompute(size_t steps)
+{
+	size_t width = m_kernel->width;
+	size_t groupSize = width * m_pointCount * ENSEMBLE_COMPONENTS;
+
+	m_pool.ParallelFor(m_groupCount, ENSEMBLE_GROUPS_PER_CHUNK, [&](size_t begin, size_t end, size_t)
+		{
+			for (size_t group = begin; group < end; ++group)
+			{
+				size_t lane = group * width;
+				EnsembleLanes lanes = { &m_springK[lane], &m_restLength[lane], &m_timeStep[lane], &m_mass[lane] };
+				m_kernel->ensembleStep(m_state.data() + group * groupSize, m_scratch.data() + group * groupSize,
+					m_pointCount, steps, lanes, m_pair);
+			}
+		});
+}
+
+void CpuEnsemble::ReadBackComputeResults(size_t system, std::vector<Point>& points) const
+{
+	if (system >= m_systemCount)
+	{
+		throw std::invalid_argument("Unknown ensemble system");
+	}
+
+	points.resize(m_pointCount);
+	for (size_t i = 0; i < m_pointCount; ++i)
+	{
+		for (size_t c = 0; c < 3; ++c)
+		{
+			points[i].position[c] = m_state[Offset(system, i, c)];
+			points[i].velocity[c] = m_state[Offset(system, i, c + 3)];
+		}
+	}
+}
+
+size_t CpuEnsemble::Offset(size_t system, size_t i, size_t c) const
+{
+	size_t width = m_kernel->width;
+	size_t group = system / width;
+	return ((group * m_pointCount + i) * ENSEMBLE_COMPONENTS + c) * width + system % width;
+}
+
+std::vector<SimulationParameters> SweepParameters(
+	const SimulationParameters& from, const SimulationParameters& to, size_t count)
+{
+	std::vector<SimulationParameters> sweep(count);
+	for (size_t index = 0; index < count; ++index)
+	{
+		float t = count > 1 ? static_cast<float>(index) / static_cast<float>(count - 1) : 0.0f;
+		auto lerp = [t](float a, float b) { return a + (b - a) * t; };
+
+		sweep[index].springK = lerp(from.springK, to.springK);
+		sweep[index].mass = lerp(from.mass, to.mass);
+		sweep[index].restLength = lerp(from.restLength, to.restLength);
+		sweep[index].timeStep = lerp(from.timeStep, to.timeStep);
+	}
+	return sweep;
+}
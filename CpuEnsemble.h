@@ -0,0 +1,61 @@
+﻿#pragma once
+
+#include "CpuForceKernels.h"
+#include "Simulation.h"
+#include "ThreadPool.h"
+
+#include <vector>
+
+// Many independent systems of the same point count, each stepped like CSMain with its own k, r0,
+// dt and m: the use case of thousands of small systems such as the one run() builds, or one
+// system under a sweep of parameters. One system runs per lane of the ensemble kernel, so a
+// vector of systems costs about what one system costs in scalar code, and the lane groups are
+// spread over the workers of the pool. RunCompute advances every group by all its steps at once,
+// with the group in L1 and no per-step synchronization.
+//
+// Every system follows the CSMain step: all pairs, the spring law, Euler. Pair terms and sums are
+// the ones of a CpuSimulation with the scalar kernel and ForceMode::AllPairs, up to the
+// multiply-adds the compiler may fuse in the vector kernels.
+class CpuEnsemble
+{
+public:
+	// Every system needs the same point count. parameters holds one entry per system, or a single
+	// one for all; kernel nullptr picks BestForceKernel(). cutoff as in CpuSimulationOptions.
+	CpuEnsemble(ThreadPool& pool, const std::vector<std::vector<Point>>& systems,
+		const std::vector<SimulationParameters>& parameters, const ForceKernel* kernel = nullptr, float cutoff = 0.0f);
+
+	// steps CSMain steps of every system
+	void RunCompute(size_t steps = 1);
+
+	void ReadBackComputeResults(size_t system, std::vector<Point>& points) const;
+
+	size_t SystemCount() const { return m_systemCount; }
+	size_t PointsCount() const { return m_pointCount; }
+	const ForceKernel& Kernel() const { return *m_kernel; }
+
+private:
+	// First float of component c of point i in the lane group of system
+	size_t Offset(size_t system, size_t i, size_t c) const;
+
+	ThreadPool& m_pool;
+	const ForceKernel* m_kernel;
+	PairParameters m_pair;
+	size_t m_systemCount;
+	size_t m_pointCount;
+	size_t m_groupCount;
+
+	// Lane groups one after the other, each in the layout of EnsembleStepFunction
+	std::vector<float> m_state;
+	std::vector<float> m_scratch;
+
+	// One lane per system, the lanes beyond the last system pad the last group
+	std::vector<float> m_springK;
+	std::vector<float> m_restLength;
+	std::vector<float> m_timeStep;
+	std::vector<float> m_mass;
+};
+
+// count parameter sets for a sweep from `from` to `to`, every field interpolated linearly; one
+// set is `from`
+std::vector<SimulationParameters> SweepParameters(
+	const SimulationParameters& from, const SimulationParameters& to, size_t count);
@@ -0,0 +1,90 @@
+﻿#include "CpuFeatures.h"
+
+#include <cstdint>
+
+#if CPU_FEATURES_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#include <immintrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+#if CPU_FEATURES_X86
+namespace
+{
+	struct CpuidResult
+	{
+		uint32_t eax, ebx, ecx, edx;
+	};
+
+	CpuidResult Cpuid(uint32_t leaf, uint32_t subleaf)
+	{
+		CpuidResult result = {};
+#ifdef _MSC_VER
+		int regs[4];
+		__cpuidex(regs, static_cast<int>(leaf), static_cast<int>(subleaf));
+		result = { static_cast<uint32_t>(regs[0]), static_cast<uint32_t>(regs[1]),
+			static_cast<uint32_t>(regs[2]), static_cast<uint32_t>(regs[3]) };
+#else
+		__cpuid_count(leaf, subleaf, result.eax, result.ebx, result.ecx, result.edx);
+#endif
+		return result;
+	}
+
+	uint64_t ReadXcr0()
+	{
+#ifdef _MSC_VER
+		return _xgetbv(0);
+#else
+		uint32_t eax, edx;
+		__asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+		return (static_cast<uint64_t>(edx) << 32) | eax;
+#endif
+	}
+
+	bool Bit(uint32_t value, int bit)
+	{
+		return (value >> bit) & 1;
+	}
+
+	CpuFeatures DetectCpuFeatures()
+	{
+		CpuFeatures features;
+
+		uint32_t maxLeaf = Cpuid(0, 0).eax;
+		if (maxLeaf < 1) return features;
+
+		CpuidResult leaf1 = Cpuid(1, 0);
+		features.sse42 = Bit(leaf1.ecx, 20);
+
+		// The OS has to save the wide registers on context switches, otherwise AVX is unusable
+		bool osxsave = Bit(leaf1.ecx, 27);
+		uint64_t xcr0 = osxsave ? ReadXcr0() : 0;
+		bool osYmm = (xcr0 & 0x06) == 0x06;  // XMM | YMM
+		bool osZmm = (xcr0 & 0xE6) == 0xE6;  // XMM | YMM | opmask | ZMM_Hi256 | Hi16_ZMM
+
+		if (maxLeaf < 7) return features;
+		CpuidResult leaf7 = Cpuid(7, 0);
+
+		bool avx = Bit(leaf1.ecx, 28);
+		bool fma = Bit(leaf1.ecx, 12);
+		bool f16c = Bit(leaf1.ecx, 29);
+		features.avx2 = osYmm && avx && fma && f16c && Bit(leaf7.ebx, 5);
+		features.avx512f = osZmm && features.avx2 && Bit(leaf7.ebx, 16);
+
+		return features;
+	}
+}
+#endif
+
+const CpuFeatures& GetCpuFeatures()
+{
+#if CPU_FEATURES_X86
+	static const CpuFeatures features = DetectCpuFeatures();
+#else
+	static const CpuFeatures features;
+#endif
+	return features;
+}
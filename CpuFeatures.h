@@ -0,0 +1,18 @@
+﻿#pragma once
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CPU_FEATURES_X86 1
+#else
+#define CPU_FEATURES_X86 0
+#endif
+
+// Instruction set extensions usable by this process: supported by the CPU and enabled by the OS
+struct CpuFeatures
+{
+	bool sse42 = false;
+	bool avx2 = false;    // Together with FMA and F16C
+	bool avx512f = false;
+};
+
+// Queried once via CPUID/XGETBV on first use
+const CpuFeatures& GetCpuFeatures();
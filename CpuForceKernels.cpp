@@ -0,0 +1,112 @@
+﻿#include "CpuForceKernels.h"
+#include "CpuForceKernelsImpl.h"
+#include "HalfFloat.h"
+
+#include <cmath>
+
+namespace
+{
+	struct Scalar
+	{
+		using Float = float;
+		using Mask = bool;
+		static constexpr size_t WIDTH = 1;
+
+		static Float Zero() { return 0.0f; }
+		static Float Set1(float value) { return value; }
+		static Float Load(const float* p) { return *p; }
+		static Float LoadPartial(const float* p, size_t count) { return count ? *p : 0.0f; }
+		static Float LoadHalf(const std::uint16_t* p) { return HalfToFloat(*p); }
+		static Float LoadHalfPartial(const std::uint16_t* p, size_t count) { return count ? HalfToFloat(*p) : 0.0f; }
+		static void Store(float* p, Float value) { *p = value; }
+		static void StorePartial(float* p, Float value, size_t count) { if (count) *p = value; }
+		static Mask TailMask(size_t count) { return count != 0; }
+
+		static Float Add(Float a, Float b) { return a + b; }
+		static Float Sub(Float a, Float b) { return a - b; }
+		static Float Mul(Float a, Float b) { return a * b; }
+		static Float Div(Float a, Float b) { return a / b; }
+		static Float Sqrt(Float a) { return std::sqrt(a); }
+		static Float Min(Float a, Float b) { return a < b ? a : b; }
+		static Float Max(Float a, Float b) { return a > b ? a : b; }
+		static Float Floor(Float a) { return std::floor(a); }
+		static Float ScalePow2(Float a, Float n) { return std::ldexp(a, static_cast<int>(n)); }
+		static Mask Greater(Float a, Float b) { return a > b; }
+		static Mask Less(Float a, Float b) { return a < b; }
+		static Mask And(Mask a, Mask b) { return a && b; }
+		static Float Select(Mask mask, Float value) { return mask ? value : 0.0f; }
+		static float ReduceAdd(Float a) { return a; }
+	};
+
+	std::vector<ForceKernel> DetectForceKernels()
+	{
+		std::vector<ForceKernel> kernels(1);
+		kernels[0].name = "scalar";
+		FillForceKernel<Scalar>(kernels[0]);
+
+#if CPU_FEATURES_X86
+		const CpuFeatures& features = GetCpuFeatures();
+		if (features.sse42)
+		{
+			kernels.emplace_back().name = "sse4.2";
+			FillForceKernelSse42(kernels.back());
+		}
+		if (features.avx2)
+		{
+			kernels.emplace_back().name = "avx2";
+			FillForceKernelAvx2(kernels.back());
+		}
+		if (features.avx512f)
+		{
+			kernels.emplace_back().name = "avx512";
+			FillForceKernelAvx512(kernels.back());
+		}
+#endif
+
+		return kernels;
+	}
+}
+
+const char* ForceLawName(ForceLaw law)
+{
+	switch (law)
+	{
+	case ForceLaw::Spring: return "spring";
+	case ForceLaw::LennardJones: return "lennard-jones";
+	case ForceLaw::Gravity: return "gravity";
+	case ForceLaw::Morse: return "morse";
+	case ForceLaw::User: return "user";
+	}
+	return "unknown";
+}
+
+const char* ForceAccumulationName(ForceAccumulation accumulation)
+{
+	switch (accumulation)
+	{
+	case ForceAccumulation::Float: return "float";
+	case ForceAccumulation::Kahan: return "kahan";
+	case ForceAccumulation::Double: return "double";
+	}
+	return "unknown";
+}
+
+const std::vector<ForceKernel>& AvailableForceKernels()
+{
+	static const std::vector<ForceKernel> kernels = DetectForceKernels();
+	return kernels;
+}
+
+const ForceKernel& BestForceKernel()
+{
+	return AvailableForceKernels().back();
+}
+
+const ForceKernel* FindForceKernel(std::string_view name)
+{
+	for (const auto& kernel : AvailableForceKernels())
+	{
+		if (name == kernel.name) return &kernel;
+	}
+	return nullptr;
+}
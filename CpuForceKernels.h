@@ -0,0 +1,189 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+// Vectorized versions of the pairwise loop of CSMain.
+//
+// A kernel adds to fx/fy/fz[i] the force exerted on point i of an i-block by the first jCount
+// points of a position stream, under one force law (CpuForceLaws.h) and one ForceAccumulation
+// compiled into it. Positions are read from separate x/y/z arrays, the streamed ones optionally
+// as half floats (HalfFloat.h). The "i != index" and
+// "r > 0.0001f" branches of the shader are one lane mask: a point paired with itself has
+// r == 0 and is masked out like any other pair closer than MIN_DISTANCE. The half kernels are
+// the exception, see ForceHalfTileFunction.
+//
+// The spring kernels compute the pair term as d * (calcForce(r) / r), one rounding away from the
+// shader's d * calcForce(r) / r. Pairs at cutoff or farther apart produce no force; callers
+// without a cutoff pass FLT_MAX.
+
+// Pair force laws of the CPU backend; the GPU backend only has the spring
+enum class ForceLaw
+{
+	Spring,       // calcForce of CSMain, k * (r - r0)
+	LennardJones, // 4 epsilon ((sigma / r)^12 - (sigma / r)^6)
+	Gravity,      // Softened gravity, -strength / sqrt(r^2 + softening^2)
+	Morse,        // depth (1 - e^(-width (r - r0)))^2
+	User          // UserForceLaw in CpuForceLaws.h
+};
+
+const size_t FORCE_LAW_COUNT = 5;
+
+const char* ForceLawName(ForceLaw law);
+
+// How a kernel sums the forces of the pairs of one i point. Float loses about one ulp of the
+// running sum per pair, so its error grows with the number of pairs; the other two keep it at a
+// few ulp of the result for any count. Sums over several kernel calls are the caller's.
+enum class ForceAccumulation
+{
+	Float,  // Float sums per lane, like totalForce in CSMain
+	Kahan,  // Compensated float sums per lane: four additions per pair instead of one
+	Double  // Float sums per lane over short runs of pairs, added up in double
+};
+
+const size_t FORCE_ACCUMULATION_COUNT = 3;
+
+const char* ForceAccumulationName(ForceAccumulation accumulation);
+
+// Coefficients of the laws other than the spring; the spring and the Morse law take k and r0
+// from SimulationParameters
+struct ForceLawParameters
+{
+	float epsilon = 1e-6f;  // Lennard-Jones well depth
+	float sigma = 0.05f;    // Lennard-Jones distance of zero potential
+	float strength = 1e-6f; // Gravity G m^2, the same for every pair
+	float softening = 0.01f;
+	float depth = 1e-4f;    // Morse well depth
+	float width = 10.0f;    // Morse well width a, in 1 / distance
+};
+
+// Force law coefficients of a kernel call: k and r0 of calcForce, the cutoff and the other laws
+struct PairParameters
+{
+	float springK;
+	float restLength;
+	float cutoff;
+	ForceLawParameters law;
+};
+
+// Positions stored in blocks: x of point j is x[(j / blockSize) * blockStride + j % blockSize],
+// y and z likewise. A single block covering every point is plain structure-of-arrays.
+template <typename T>
+struct BasicPositionStream
+{
+	const T* x;
+	const T* y;
+	const T* z;
+	size_t blockSize;
+	size_t blockStride;
+};
+
+using PositionStream = BasicPositionStream<float>;
+
+// Positions as IEEE half floats, see HalfFloat.h
+using HalfPositionStream = BasicPositionStream<std::uint16_t>;
+
+// Stream starting at point first: either first is at a block boundary, or the stream is one
+// block and the slice is used for at most blockSize - first points
+template <typename T>
+inline BasicPositionStream<T> SlicePositions(const BasicPositionStream<T>& stream, size_t first)
+{
+	size_t offset = (first / stream.blockSize) * stream.blockStride + first % stream.blockSize;
+	return { stream.x + offset, stream.y + offset, stream.z + offset, stream.blockSize, stream.blockStride };
+}
+
+using ForceTileFunction = void (*)(
+	const float* ix, const float* iy, const float* iz, size_t iCount,
+	const PositionStream& j, size_t jCount, const PairParameters& pair,
+	float* fx, float* fy, float* fz);
+
+// The same with the streamed positions at half precision: half the bytes per pair, and
+// differences off by up to half an ulp of the half position. That makes r of a point paired with
+// its own rounded copy larger than MIN_DISTANCE, so the pair is skipped by index instead: self[i]
+// is the index of i point i in the stream, jCount or more when it is not among the first jCount.
+using ForceHalfTileFunction = void (*)(
+	const float* ix, const float* iy, const float* iz, size_t iCount,
+	const HalfPositionStream& j, size_t jCount, const PairParameters& pair, const size_t* self,
+	float* fx, float* fy, float* fz);
+
+// Newton's third law variant: for every pair of an i-block and a j-block adds the force on i to
+// fix/fiy/fiz and the opposite force to fjx/fjy/fjz. With triangle set both blocks are the same
+// points and only pairs with j > i are visited.
+using ForceSymmetricTileFunction = void (*)(
+	const float* ix, const float* iy, const float* iz, size_t iCount,
+	const float* jx, const float* jy, const float* jz, size_t jCount, const PairParameters& pair,
+	bool triangle,
+	float* fix, float* fiy, float* fiz,
+	float* fjx, float* fjy, float* fjz);
+
+// Values per point of an ensemble state: x, y, z, then the velocity
+const size_t ENSEMBLE_COMPONENTS = 6;
+
+// Per-lane coefficients of an ensemble kernel call, kernel width floats each
+struct EnsembleLanes
+{
+	const float* springK;
+	const float* restLength;
+	const float* timeStep;
+	const float* mass;
+};
+
+// Ensemble kernel: advances width independent systems of pointCount points by steps CSMain steps
+// (spring law, Euler), one system per lane with the k, r0, dt and m of that lane. Component c of
+// point i of lane l is state[(i * ENSEMBLE_COMPONENTS + c) * width + l]; scratch is as large and
+// its contents are lost. pair only supplies the cutoff. The forces on a point are summed over the
+// other points in order, as the scalar tile kernel does.
+using EnsembleStepFunction = void (*)(
+	float* state, float* scratch, size_t pointCount, size_t steps,
+	const EnsembleLanes& lanes, const PairParameters& pair);
+
+// The kernels of one force law and accumulation
+struct ForceLawKernels
+{
+	ForceTileFunction tile;
+	ForceHalfTileFunction halfTile;
+
+	// Only with ForceAccumulation::Float, nullptr otherwise: the j side is summed in place
+	ForceSymmetricTileFunction symmetricTile;
+};
+
+struct ForceKernel
+{
+	const char* name;
+	size_t width; // Float lanes per vector
+
+	// Indexed by ForceAccumulation, then ForceLaw
+	ForceLawKernels laws[FORCE_ACCUMULATION_COUNT][FORCE_LAW_COUNT];
+
+	// The spring with r0 == 0, where the pair term is k * d: no square root or division per pair.
+	// Distances are compared squared, so pairs within rounding of MIN_DISTANCE or the cutoff
+	// may be classified differently.
+	ForceLawKernels linearSpring[FORCE_ACCUMULATION_COUNT];
+
+	// Like the spring tile, but only the rest length part of the spring force, -k * r0 * d / r.
+	// The linear part k * d of every pair is left to the caller, which can sum it in O(N) for all
+	// pairs at once (ForceMode::Centroid); to cancel it for the pairs the shader skips, the pairs
+	// closer than MIN_DISTANCE get -k * d instead. Only valid without a cutoff.
+	ForceTileFunction restLengthTile[FORCE_ACCUMULATION_COUNT];
+
+	EnsembleStepFunction ensembleStep;
+
+	// Kernels for a law, picked once instead of per pair
+	const ForceLawKernels& Law(ForceLaw law, float restLength, ForceAccumulation accumulation = ForceAccumulation::Float) const
+	{
+		size_t sums = static_cast<size_t>(accumulation);
+		if (law == ForceLaw::Spring && restLength == 0.0f) return linearSpring[sums];
+		return laws[sums][static_cast<size_t>(law)];
+	}
+};
+
+// Kernels built in and supported by this CPU, slowest first; the scalar one is always there
+const std::vector<ForceKernel>& AvailableForceKernels();
+
+// Widest available kernel, chosen once from CPUID
+const ForceKernel& BestForceKernel();
+
+// Kernel by name ("scalar", "sse4.2", "avx2", "avx512"), nullptr if it is not available
+const ForceKernel* FindForceKernel(std::string_view name);
@@ -0,0 +1,93 @@
+﻿#include "CpuFeatures.h"
+#include "CpuForceKernels.h"
+
+#if CPU_FEATURES_X86
+
+#ifdef __GNUC__
+#pragma GCC target("avx2,fma,f16c")
+#endif
+
+// Everything below is compiled for this instruction set
+#include "CpuForceKernelsImpl.h"
+
+#include <immintrin.h>
+
+namespace
+{
+	struct Avx2
+	{
+		using Float = __m256;
+		using Mask = __m256;
+		static constexpr size_t WIDTH = 8;
+
+		static Float Zero() { return _mm256_setzero_ps(); }
+		static Float Set1(float value) { return _mm256_set1_ps(value); }
+		static Float Load(const float* p) { return _mm256_loadu_ps(p); }
+
+		static Float LoadPartial(const float* p, size_t count)
+		{
+			return _mm256_maskload_ps(p, _mm256_castps_si256(TailMask(count)));
+		}
+
+		static Float LoadHalf(const std::uint16_t* p)
+		{
+			return _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+		}
+
+		static Float LoadHalfPartial(const std::uint16_t* p, size_t count)
+		{
+			alignas(16) std::uint16_t lanes[WIDTH] = {};
+			for (size_t i = 0; i < count; ++i) lanes[i] = p[i];
+			return LoadHalf(lanes);
+		}
+
+		static void Store(float* p, Float value) { _mm256_storeu_ps(p, value); }
+
+		static void StorePartial(float* p, Float value, size_t count)
+		{
+			_mm256_maskstore_ps(p, _mm256_castps_si256(TailMask(count)), value);
+		}
+
+		static Mask TailMask(size_t count)
+		{
+			__m256i index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+			return _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(static_cast<int>(count)), index));
+		}
+
+		static Float Add(Float a, Float b) { return _mm256_add_ps(a, b); }
+		static Float Sub(Float a, Float b) { return _mm256_sub_ps(a, b); }
+		static Float Mul(Float a, Float b) { return _mm256_mul_ps(a, b); }
+		static Float Div(Float a, Float b) { return _mm256_div_ps(a, b); }
+		static Float Sqrt(Float a) { return _mm256_sqrt_ps(a); }
+		static Float Min(Float a, Float b) { return _mm256_min_ps(a, b); }
+		static Float Max(Float a, Float b) { return _mm256_max_ps(a, b); }
+		static Float Floor(Float a) { return _mm256_floor_ps(a); }
+
+		static Float ScalePow2(Float a, Float n)
+		{
+			__m256i exponent = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+			return _mm256_mul_ps(a, _mm256_castsi256_ps(exponent));
+		}
+
+		static Mask Greater(Float a, Float b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+		static Mask Less(Float a, Float b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+		static Mask And(Mask a, Mask b) { return _mm256_and_ps(a, b); }
+		static Float Select(Mask mask, Float value) { return _mm256_and_ps(mask, value); }
+
+		static float ReduceAdd(Float a)
+		{
+			__m128 sums = _mm_add_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+			__m128 shuffled = _mm_movehdup_ps(sums);
+			sums = _mm_add_ps(sums, shuffled);
+			shuffled = _mm_movehl_ps(shuffled, sums);
+			return _mm_cvtss_f32(_mm_add_ss(sums, shuffled));
+		}
+	};
+}
+
+void FillForceKernelAvx2(ForceKernel& kernel)
+{
+	FillForceKernel<Avx2>(kernel);
+}
+
+#endif
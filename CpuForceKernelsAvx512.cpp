@@ -0,0 +1,87 @@
+﻿#include "CpuFeatures.h"
+#include "CpuForceKernels.h"
+
+#if CPU_FEATURES_X86
+
+#ifdef __GNUC__
+#pragma GCC target("avx512f")
+#endif
+
+// Everything below is compiled for this instruction set
+#include "CpuForceKernelsImpl.h"
+
+#include <immintrin.h>
+
+namespace
+{
+	struct Avx512
+	{
+		using Float = __m512;
+		using Mask = __mmask16;
+		static constexpr size_t WIDTH = 16;
+
+		// The unmasked forms of several intrinsics pass GCC an undefined vector, which trips
+		// -Wmaybe-uninitialized; zero masking with every lane set compiles to the same code
+		static constexpr Mask ALL_LANES = 0xFFFF;
+
+		static Float Zero() { return _mm512_setzero_ps(); }
+		static Float Set1(float value) { return _mm512_set1_ps(value); }
+		static Float Load(const float* p) { return _mm512_loadu_ps(p); }
+		static Float LoadPartial(const float* p, size_t count) { return _mm512_maskz_loadu_ps(TailMask(count), p); }
+		static Float LoadHalf(const std::uint16_t* p)
+		{
+			return _mm512_maskz_cvtph_ps(ALL_LANES, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)));
+		}
+
+		// A masked 16-bit load would need AVX-512BW
+		static Float LoadHalfPartial(const std::uint16_t* p, size_t count)
+		{
+			alignas(32) std::uint16_t lanes[WIDTH] = {};
+			for (size_t i = 0; i < count; ++i) lanes[i] = p[i];
+			return LoadHalf(lanes);
+		}
+
+		static void Store(float* p, Float value) { _mm512_storeu_ps(p, value); }
+		static void StorePartial(float* p, Float value, size_t count) { _mm512_mask_storeu_ps(p, TailMask(count), value); }
+		static Mask TailMask(size_t count) { return static_cast<Mask>((1u << count) - 1); }
+
+		// _mm512_castps512_ps256 extracts with an undefined vector as well
+		static __m256 LowHalf(Float a)
+		{
+			return _mm256_castpd_ps(_mm512_maskz_extractf64x4_pd(0xF, _mm512_castps_pd(a), 0));
+		}
+
+		static Float Add(Float a, Float b) { return _mm512_add_ps(a, b); }
+		static Float Sub(Float a, Float b) { return _mm512_sub_ps(a, b); }
+		static Float Mul(Float a, Float b) { return _mm512_mul_ps(a, b); }
+		static Float Div(Float a, Float b) { return _mm512_div_ps(a, b); }
+		static Float Sqrt(Float a) { return _mm512_maskz_sqrt_ps(ALL_LANES, a); }
+		static Float Min(Float a, Float b) { return _mm512_maskz_min_ps(ALL_LANES, a, b); }
+		static Float Max(Float a, Float b) { return _mm512_maskz_max_ps(ALL_LANES, a, b); }
+		static Float Floor(Float a) { return _mm512_maskz_roundscale_ps(ALL_LANES, a, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC); }
+		static Float ScalePow2(Float a, Float n) { return _mm512_maskz_scalef_ps(ALL_LANES, a, n); }
+		static Mask Greater(Float a, Float b) { return _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ); }
+		static Mask Less(Float a, Float b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+		static Mask And(Mask a, Mask b) { return static_cast<Mask>(a & b); }
+		static Float Select(Mask mask, Float value) { return _mm512_maskz_mov_ps(mask, value); }
+
+		// By hand, as _mm512_reduce_add_ps has the same warning
+		static float ReduceAdd(Float a)
+		{
+			Float swapped = _mm512_maskz_shuffle_f32x4(ALL_LANES, a, a, _MM_SHUFFLE(1, 0, 3, 2));
+			__m256 halves = _mm256_add_ps(LowHalf(a), LowHalf(swapped));
+			__m128 sums = _mm_add_ps(_mm256_castps256_ps128(halves), _mm256_extractf128_ps(halves, 1));
+			__m128 shuffled = _mm_movehdup_ps(sums);
+			sums = _mm_add_ps(sums, shuffled);
+			shuffled = _mm_movehl_ps(shuffled, sums);
+			return _mm_cvtss_f32(_mm_add_ss(sums, shuffled));
+		}
+	};
+}
+
+void FillForceKernelAvx512(ForceKernel& kernel)
+{
+	FillForceKernel<Avx512>(kernel);
+}
+
+#endif
@@ -0,0 +1,465 @@
+﻿#pragma once
+
+// Kernel template shared by the CpuForceKernels*.cpp translation units. Each of them is built
+// for a different instruction set, so this header must stay free of standard library code:
+// inline functions compiled for AVX could otherwise be picked by the linker for everybody.
+// Headers that do pull in the standard library are included by those units before switching
+// the instruction set.
+
+#include "CpuFeatures.h"
+#include "CpuForceKernels.h"
+#include "CpuForceLaws.h"
+#include "Simulation.h"
+
+#include <cstddef>
+#include <cstdint>
+
+// S describes one instruction set:
+//   Float, Mask, WIDTH
+//   Zero, Set1, Load, LoadPartial (zero beyond count), Store, StorePartial (first count lanes)
+//   LoadHalf, LoadHalfPartial (IEEE half floats widened to Float, zero beyond count)
+//   TailMask (first count lanes)
+//   Add, Sub, Mul, Div, Sqrt, Min, Max, Floor, ScalePow2 (a * 2^n for integral n)
+//   Greater, Less, And, Select (value where mask is set, 0 elsewhere), ReduceAdd
+
+// Distance range of a kernel call in every lane
+template <typename S>
+struct RangeConstants
+{
+	typename S::Float minimum;
+	typename S::Float minimumSquared;
+	typename S::Float cutoff;
+	typename S::Float cutoffSquared;
+
+	explicit RangeConstants(const PairParameters& pair)
+		: minimum(S::Set1(MIN_DISTANCE))
+		, minimumSquared(S::Set1(MIN_DISTANCE * MIN_DISTANCE))
+		, cutoff(S::Set1(pair.cutoff))
+		, cutoffSquared(S::Set1(pair.cutoff * pair.cutoff))
+	{
+	}
+};
+
+// Everything a kernel call broadcasts once: the range and the law's coefficients
+template <typename S, typename Law>
+struct PairConstants
+{
+	RangeConstants<S> range;
+	typename Law::template Constants<S> law;
+
+	explicit PairConstants(const PairParameters& pair) : range(pair), law(pair) {}
+};
+
+// Force exerted on p by q in every lane of lanes, zero in the other lanes and beyond the cutoff
+template <typename S, typename Law>
+inline void PairForce(
+	typename S::Float px, typename S::Float py, typename S::Float pz,
+	typename S::Float qx, typename S::Float qy, typename S::Float qz,
+	const PairConstants<S, Law>& constants, typename S::Mask lanes,
+	typename S::Float& fx, typename S::Float& fy, typename S::Float& fz)
+{
+	typename S::Float dx = S::Sub(qx, px);
+	typename S::Float dy = S::Sub(qy, py);
+	typename S::Float dz = S::Sub(qz, pz);
+	typename S::Float r2 = S::Add(S::Add(S::Mul(dx, dx), S::Mul(dy, dy)), S::Mul(dz, dz));
+
+	typename S::Float scale;
+	if constexpr (Law::USES_DISTANCE)
+	{
+		typename S::Float r = S::Sqrt(r2);
+		typename S::Mask valid = S::And(S::And(S::Greater(r, constants.range.minimum), S::Less(r, constants.range.cutoff)), lanes);
+		scale = Law::template Scale<S>(r2, r, valid, lanes, constants.law);
+	}
+	else
+	{
+		typename S::Mask valid = S::And(S::And(
+			S::Greater(r2, constants.range.minimumSquared), S::Less(r2, constants.range.cutoffSquared)), lanes);
+		scale = Law::template Scale<S>(r2, r2, valid, lanes, constants.law);
+	}
+
+	fx = S::Mul(dx, scale);
+	fy = S::Mul(dy, scale);
+	fz = S::Mul(dz, scale);
+}
+
+// Pairs per lane summed in float before ForceAccumulation::Double adds them to its double sums
+const size_t DOUBLE_SUM_RUN = 16;
+
+// Sum of the pair forces on one i point, per lane until it is added to the point's force
+template <typename S, ForceAccumulation A>
+struct ForceSum;
+
+template <typename S>
+struct ForceSum<S, ForceAccumulation::Float>
+{
+	typename S::Float x;
+	typename S::Float y;
+	typename S::Float z;
+
+	ForceSum() : x(S::Zero()), y(S::Zero()), z(S::Zero()) {}
+
+	void Add(typename S::Float fx, typename S::Float fy, typename S::Float fz)
+	{
+		x = S::Add(x, fx);
+		y = S::Add(y, fy);
+		z = S::Add(z, fz);
+	}
+
+	void AddTo(float* fx, float* fy, float* fz)
+	{
+		*fx += S::ReduceAdd(x);
+		*fy += S::ReduceAdd(y);
+		*fz += S::ReduceAdd(z);
+	}
+};
+
+template <typename S>
+struct ForceSum<S, ForceAccumulation::Kahan>
+{
+	// The sums, and the rounding errors of the additions so far, taken off the next term
+	typename S::Float x;
+	typename S::Float y;
+	typename S::Float z;
+	typename S::Float errorX;
+	typename S::Float errorY;
+	typename S::Float errorZ;
+
+	ForceSum() : x(S::Zero()), y(S::Zero()), z(S::Zero()), errorX(S::Zero()), errorY(S::Zero()), errorZ(S::Zero()) {}
+
+	static void Compensated(typename S::Float& sum, typename S::Float& error, typename S::Float value)
+	{
+		typename S::Float corrected = S::Sub(value, error);
+		typename S::Float next = S::Add(sum, corrected);
+		error = S::Sub(S::Sub(next, sum), corrected);
+		sum = next;
+	}
+
+	void Add(typename S::Float fx, typename S::Float fy, typename S::Float fz)
+	{
+		Compensated(x, errorX, fx);
+		Compensated(y, errorY, fy);
+		Compensated(z, errorZ, fz);
+	}
+
+	void AddTo(float* fx, float* fy, float* fz)
+	{
+		*fx = static_cast<float>(static_cast<double>(*fx) + S::ReduceAdd(x) - S::ReduceAdd(errorX));
+		*fy = static_cast<float>(static_cast<double>(*fy) + S::ReduceAdd(y) - S::ReduceAdd(errorY));
+		*fz = static_cast<float>(static_cast<double>(*fz) + S::ReduceAdd(z) - S::ReduceAdd(errorZ));
+	}
+};
+
+template <typename S>
+struct ForceSum<S, ForceAccumulation::Double>
+{
+	typename S::Float x;
+	typename S::Float y;
+	typename S::Float z;
+	size_t run;
+	double totalX;
+	double totalY;
+	double totalZ;
+
+	ForceSum() : x(S::Zero()), y(S::Zero()), z(S::Zero()), run(0), totalX(0.0), totalY(0.0), totalZ(0.0) {}
+
+	void Add(typename S::Float fx, typename S::Float fy, typename S::Float fz)
+	{
+		x = S::Add(x, fx);
+		y = S::Add(y, fy);
+		z = S::Add(z, fz);
+		if (++run == DOUBLE_SUM_RUN) Flush();
+	}
+
+	void Flush()
+	{
+		totalX += S::ReduceAdd(x);
+		totalY += S::ReduceAdd(y);
+		totalZ += S::ReduceAdd(z);
+		x = y = z = S::Zero();
+		run = 0;
+	}
+
+	void AddTo(float* fx, float* fy, float* fz)
+	{
+		Flush();
+		*fx = static_cast<float>(*fx + totalX);
+		*fy = static_cast<float>(*fy + totalY);
+		*fz = static_cast<float>(*fz + totalZ);
+	}
+};
+
+// Streamed positions as floats or half floats
+template <typename S>
+inline typename S::Float LoadPositions(const float* p) { return S::Load(p); }
+
+template <typename S>
+inline typename S::Float LoadPositions(const std::uint16_t* p) { return S::LoadHalf(p); }
+
+template <typename S>
+inline typename S::Float LoadPositionsPartial(const float* p, size_t count) { return S::LoadPartial(p, count); }
+
+template <typename S>
+inline typename S::Float LoadPositionsPartial(const std::uint16_t* p, size_t count) { return S::LoadHalfPartial(p, count); }
+
+template <typename S, typename Law, ForceAccumulation A>
+inline void AccumulatePairs(
+	typename S::Float px, typename S::Float py, typename S::Float pz,
+	typename S::Float qx, typename S::Float qy, typename S::Float qz,
+	const PairConstants<S, Law>& constants, typename S::Mask lanes,
+	ForceSum<S, A>& sum)
+{
+	typename S::Float fx, fy, fz;
+	PairForce<S, Law>(px, py, pz, qx, qy, qz, constants, lanes, fx, fy, fz);
+	sum.Add(fx, fy, fz);
+}
+
+// Pairs of p with count streamed points, in full vectors and a partial one
+template <typename S, typename Law, ForceAccumulation A, typename T>
+inline void AccumulateRange(
+	typename S::Float px, typename S::Float py, typename S::Float pz,
+	const T* jx, const T* jy, const T* jz, size_t count,
+	const PairConstants<S, Law>& constants, ForceSum<S, A>& sum)
+{
+	size_t fullCount = count - count % S::WIDTH;
+	size_t tailCount = count - fullCount;
+
+	for (size_t lane = 0; lane < fullCount; lane += S::WIDTH)
+	{
+		AccumulatePairs<S, Law, A>(px, py, pz,
+			LoadPositions<S>(jx + lane), LoadPositions<S>(jy + lane), LoadPositions<S>(jz + lane),
+			constants, S::TailMask(S::WIDTH), sum);
+	}
+
+	if (tailCount)
+	{
+		AccumulatePairs<S, Law, A>(px, py, pz,
+			LoadPositionsPartial<S>(jx + fullCount, tailCount),
+			LoadPositionsPartial<S>(jy + fullCount, tailCount),
+			LoadPositionsPartial<S>(jz + fullCount, tailCount),
+			constants, S::TailMask(tailCount), sum);
+	}
+}
+
+// ForceTileFunction, or ForceHalfTileFunction with SKIP_SELF
+template <typename S, typename Law, ForceAccumulation A, bool SKIP_SELF, typename T>
+inline void AccumulateTile(
+	const float* ix, const float* iy, const float* iz, size_t iCount,
+	const BasicPositionStream<T>& j, size_t jCount, const PairParameters& pair, const size_t* self,
+	float* fx, float* fy, float* fz)
+{
+	PairConstants<S, Law> constants(pair);
+
+	for (size_t i = 0; i < iCount; ++i)
+	{
+		typename S::Float px = S::Set1(ix[i]);
+		typename S::Float py = S::Set1(iy[i]);
+		typename S::Float pz = S::Set1(iz[i]);
+
+		ForceSum<S, A> sum;
+
+		size_t offset = 0;
+		for (size_t blockStart = 0; blockStart < jCount; blockStart += j.blockSize, offset += j.blockStride)
+		{
+			const T* jx = j.x + offset;
+			const T* jy = j.y + offset;
+			const T* jz = j.z + offset;
+
+			size_t count = jCount - blockStart < j.blockSize ? jCount - blockStart : j.blockSize;
+
+			// The block is split around the i point itself, if it is in there
+			size_t skip = SKIP_SELF ? self[i] - blockStart : count;
+			if (SKIP_SELF && skip < count)
+			{
+				AccumulateRange<S, Law, A>(px, py, pz, jx, jy, jz, skip, constants, sum);
+				AccumulateRange<S, Law, A>(px, py, pz, jx + skip + 1, jy + skip + 1, jz + skip + 1,
+					count - skip - 1, constants, sum);
+			}
+			else
+			{
+				AccumulateRange<S, Law, A>(px, py, pz, jx, jy, jz, count, constants, sum);
+			}
+		}
+
+		sum.AddTo(fx + i, fy + i, fz + i);
+	}
+}
+
+template <typename S, typename Law, ForceAccumulation A>
+void AccumulateForceTile(
+	const float* ix, const float* iy, const float* iz, size_t iCount,
+	const PositionStream& j, size_t jCount, const PairParameters& pair,
+	float* fx, float* fy, float* fz)
+{
+	AccumulateTile<S, Law, A, false>(ix, iy, iz, iCount, j, jCount, pair, nullptr, fx, fy, fz);
+}
+
+template <typename S, typename Law, ForceAccumulation A>
+void AccumulateHalfForceTile(
+	const float* ix, const float* iy, const float* iz, size_t iCount,
+	const HalfPositionStream& j, size_t jCount, const PairParameters& pair, const size_t* self,
+	float* fx, float* fy, float* fz)
+{
+	AccumulateTile<S, Law, A, true>(ix, iy, iz, iCount, j, jCount, pair, self, fx, fy, fz);
+}
+
+template <typename S, typename Law>
+void AccumulateSymmetricTile(
+	const float* ix, const float* iy, const float* iz, size_t iCount,
+	const float* jx, const float* jy, const float* jz, size_t jCount, const PairParameters& pair,
+	bool triangle,
+	float* fix, float* fiy, float* fiz,
+	float* fjx, float* fjy, float* fjz)
+{
+	PairConstants<S, Law> constants(pair);
+
+	for (size_t i = 0; i < iCount; ++i)
+	{
+		typename S::Float px = S::Set1(ix[i]);
+		typename S::Float py = S::Set1(iy[i]);
+		typename S::Float pz = S::Set1(iz[i]);
+
+		typename S::Float ax = S::Zero();
+		typename S::Float ay = S::Zero();
+		typename S::Float az = S::Zero();
+
+		size_t j = triangle ? i + 1 : 0;
+		for (; j + S::WIDTH <= jCount; j += S::WIDTH)
+		{
+			typename S::Float fx, fy, fz;
+			PairForce<S, Law>(px, py, pz, S::Load(jx + j), S::Load(jy + j), S::Load(jz + j),
+				constants, S::TailMask(S::WIDTH), fx, fy, fz);
+
+			ax = S::Add(ax, fx);
+			ay = S::Add(ay, fy);
+			az = S::Add(az, fz);
+
+			S::Store(fjx + j, S::Sub(S::Load(fjx + j), fx));
+			S::Store(fjy + j, S::Sub(S::Load(fjy + j), fy));
+			S::Store(fjz + j, S::Sub(S::Load(fjz + j), fz));
+		}
+
+		if (j < jCount)
+		{
+			size_t tailCount = jCount - j;
+
+			typename S::Float fx, fy, fz;
+			PairForce<S, Law>(px, py, pz,
+				S::LoadPartial(jx + j, tailCount), S::LoadPartial(jy + j, tailCount), S::LoadPartial(jz + j, tailCount),
+				constants, S::TailMask(tailCount), fx, fy, fz);
+
+			ax = S::Add(ax, fx);
+			ay = S::Add(ay, fy);
+			az = S::Add(az, fz);
+
+			S::StorePartial(fjx + j, S::Sub(S::LoadPartial(fjx + j, tailCount), fx), tailCount);
+			S::StorePartial(fjy + j, S::Sub(S::LoadPartial(fjy + j, tailCount), fy), tailCount);
+			S::StorePartial(fjz + j, S::Sub(S::LoadPartial(fjz + j, tailCount), fz), tailCount);
+		}
+
+		fix[i] += S::ReduceAdd(ax);
+		fiy[i] += S::ReduceAdd(ay);
+		fiz[i] += S::ReduceAdd(az);
+	}
+}
+
+template <typename S>
+void AdvanceEnsemble(
+	float* state, float* scratch, size_t pointCount, size_t steps,
+	const EnsembleLanes& lanes, const PairParameters& pair)
+{
+	PairConstants<S, SpringLaw> constants(pair);
+	constants.law.springK = S::Load(lanes.springK);
+	constants.law.restLength = S::Load(lanes.restLength);
+	typename S::Float dt = S::Load(lanes.timeStep);
+	typename S::Float mass = S::Load(lanes.mass);
+
+	const size_t stride = ENSEMBLE_COMPONENTS * S::WIDTH;
+	float* current = state;
+	float* next = scratch;
+
+	for (size_t step = 0; step < steps; ++step)
+	{
+		for (size_t i = 0; i < pointCount; ++i)
+		{
+			const float* p = current + i * stride;
+			typename S::Float px = S::Load(p);
+			typename S::Float py = S::Load(p + S::WIDTH);
+			typename S::Float pz = S::Load(p + 2 * S::WIDTH);
+
+			typename S::Float force[3] = { S::Zero(), S::Zero(), S::Zero() };
+			for (size_t j = 0; j < pointCount; ++j)
+			{
+				if (j == i) continue;
+
+				const float* q = current + j * stride;
+				typename S::Float fx, fy, fz;
+				PairForce<S, SpringLaw>(px, py, pz, S::Load(q), S::Load(q + S::WIDTH), S::Load(q + 2 * S::WIDTH),
+					constants, S::TailMask(S::WIDTH), fx, fy, fz);
+
+				force[0] = S::Add(force[0], fx);
+				force[1] = S::Add(force[1], fy);
+				force[2] = S::Add(force[2], fz);
+			}
+
+			float* n = next + i * stride;
+			for (size_t c = 0; c < 3; ++c)
+			{
+				typename S::Float position = S::Load(p + c * S::WIDTH);
+				typename S::Float velocity = S::Load(p + (c + 3) * S::WIDTH);
+				S::Store(n + c * S::WIDTH, S::Add(position, S::Mul(velocity, dt)));
+				S::Store(n + (c + 3) * S::WIDTH, S::Add(velocity, S::Mul(S::Div(force[c], mass), dt)));
+			}
+		}
+
+		float* written = next;
+		next = current;
+		current = written;
+	}
+
+	if (current != state)
+	{
+		for (size_t offset = 0; offset < pointCount * stride; offset += S::WIDTH)
+		{
+			S::Store(state + offset, S::Load(current + offset));
+		}
+	}
+}
+
+template <typename S, typename Law, ForceAccumulation A>
+ForceLawKernels LawKernels()
+{
+	ForceSymmetricTileFunction symmetricTile = nullptr;
+	if constexpr (A == ForceAccumulation::Float) symmetricTile = AccumulateSymmetricTile<S, Law>;
+	return { AccumulateForceTile<S, Law, A>, AccumulateHalfForceTile<S, Law, A>, symmetricTile };
+}
+
+template <typename S, ForceAccumulation A>
+void FillAccumulation(ForceKernel& kernel)
+{
+	ForceLawKernels* laws = kernel.laws[static_cast<size_t>(A)];
+	laws[static_cast<size_t>(ForceLaw::Spring)] = LawKernels<S, SpringLaw, A>();
+	laws[static_cast<size_t>(ForceLaw::LennardJones)] = LawKernels<S, LennardJonesLaw, A>();
+	laws[static_cast<size_t>(ForceLaw::Gravity)] = LawKernels<S, GravityLaw, A>();
+	laws[static_cast<size_t>(ForceLaw::Morse)] = LawKernels<S, MorseLaw, A>();
+	laws[static_cast<size_t>(ForceLaw::User)] = LawKernels<S, UserForceLaw, A>();
+	kernel.linearSpring[static_cast<size_t>(A)] = LawKernels<S, LinearSpringLaw, A>();
+	kernel.restLengthTile[static_cast<size_t>(A)] = AccumulateForceTile<S, SpringRestLengthLaw, A>;
+}
+
+// Sets the kernels of every force law and accumulation, and the ensemble kernel, to the ones for S
+template <typename S>
+void FillForceKernel(ForceKernel& kernel)
+{
+	kernel.width = S::WIDTH;
+	FillAccumulation<S, ForceAccumulation::Float>(kernel);
+	FillAccumulation<S, ForceAccumulation::Kahan>(kernel);
+	FillAccumulation<S, ForceAccumulation::Double>(kernel);
+	kernel.ensembleStep = AdvanceEnsemble<S>;
+}
+
+// Defined in CpuForceKernels<Isa>.cpp
+#if CPU_FEATURES_X86
+void FillForceKernelSse42(ForceKernel& kernel);
+void FillForceKernelAvx2(ForceKernel& kernel);
+void FillForceKernelAvx512(ForceKernel& kernel);
+#endif
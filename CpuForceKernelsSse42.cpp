@@ -0,0 +1,102 @@
+﻿#include "CpuFeatures.h"
+#include "CpuForceKernels.h"
+
+#if CPU_FEATURES_X86
+
+#ifdef __GNUC__
+#pragma GCC target("sse4.2")
+#endif
+
+// Everything below is compiled for this instruction set
+#include "CpuForceKernelsImpl.h"
+
+#include <immintrin.h>
+
+namespace
+{
+	struct Sse42
+	{
+		using Float = __m128;
+		using Mask = __m128;
+		static constexpr size_t WIDTH = 4;
+
+		static Float Zero() { return _mm_setzero_ps(); }
+		static Float Set1(float value) { return _mm_set1_ps(value); }
+		static Float Load(const float* p) { return _mm_loadu_ps(p); }
+
+		static Float LoadPartial(const float* p, size_t count)
+		{
+			alignas(16) float lanes[WIDTH] = {};
+			for (size_t i = 0; i < count; ++i) lanes[i] = p[i];
+			return _mm_load_ps(lanes);
+		}
+
+		// No F16C before AVX: the half bits moved into float position and scaled by 2^112 to
+		// rebias the exponent, which also widens denormal halves; no infinities or NaNs expected
+		static Float LoadHalf(const std::uint16_t* p)
+		{
+			__m128i half = _mm_cvtepu16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)));
+			__m128i sign = _mm_slli_epi32(_mm_and_si128(half, _mm_set1_epi32(0x8000)), 16);
+			__m128i magnitude = _mm_slli_epi32(_mm_and_si128(half, _mm_set1_epi32(0x7fff)), 13);
+			__m128 value = _mm_mul_ps(_mm_castsi128_ps(magnitude), _mm_castsi128_ps(_mm_set1_epi32(0x77800000)));
+			return _mm_or_ps(value, _mm_castsi128_ps(sign));
+		}
+
+		static Float LoadHalfPartial(const std::uint16_t* p, size_t count)
+		{
+			alignas(16) std::uint16_t lanes[WIDTH] = {};
+			for (size_t i = 0; i < count; ++i) lanes[i] = p[i];
+			return LoadHalf(lanes);
+		}
+
+		static void Store(float* p, Float value) { _mm_storeu_ps(p, value); }
+
+		static void StorePartial(float* p, Float value, size_t count)
+		{
+			alignas(16) float lanes[WIDTH];
+			_mm_store_ps(lanes, value);
+			for (size_t i = 0; i < count; ++i) p[i] = lanes[i];
+		}
+
+		static Mask TailMask(size_t count)
+		{
+			__m128i index = _mm_setr_epi32(0, 1, 2, 3);
+			return _mm_castsi128_ps(_mm_cmplt_epi32(index, _mm_set1_epi32(static_cast<int>(count))));
+		}
+
+		static Float Add(Float a, Float b) { return _mm_add_ps(a, b); }
+		static Float Sub(Float a, Float b) { return _mm_sub_ps(a, b); }
+		static Float Mul(Float a, Float b) { return _mm_mul_ps(a, b); }
+		static Float Div(Float a, Float b) { return _mm_div_ps(a, b); }
+		static Float Sqrt(Float a) { return _mm_sqrt_ps(a); }
+		static Float Min(Float a, Float b) { return _mm_min_ps(a, b); }
+		static Float Max(Float a, Float b) { return _mm_max_ps(a, b); }
+		static Float Floor(Float a) { return _mm_floor_ps(a); }
+
+		static Float ScalePow2(Float a, Float n)
+		{
+			__m128i exponent = _mm_slli_epi32(_mm_add_epi32(_mm_cvtps_epi32(n), _mm_set1_epi32(127)), 23);
+			return _mm_mul_ps(a, _mm_castsi128_ps(exponent));
+		}
+
+		static Mask Greater(Float a, Float b) { return _mm_cmpgt_ps(a, b); }
+		static Mask Less(Float a, Float b) { return _mm_cmplt_ps(a, b); }
+		static Mask And(Mask a, Mask b) { return _mm_and_ps(a, b); }
+		static Float Select(Mask mask, Float value) { return _mm_and_ps(mask, value); }
+
+		static float ReduceAdd(Float a)
+		{
+			__m128 shuffled = _mm_movehdup_ps(a);
+			__m128 sums = _mm_add_ps(a, shuffled);
+			shuffled = _mm_movehl_ps(shuffled, sums);
+			return _mm_cvtss_f32(_mm_add_ss(sums, shuffled));
+		}
+	};
+}
+
+void FillForceKernelSse42(ForceKernel& kernel)
+{
+	FillForceKernel<Sse42>(kernel);
+}
+
+#endif
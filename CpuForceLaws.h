@@ -0,0 +1,228 @@
+﻿#pragma once
+
+// Force law policies for the kernel templates in CpuForceKernelsImpl.h. Like that header this one
+// is compiled once per instruction set and must stay free of standard library code.
+//
+// A law gives the scale of the pair term: the force exerted on p by q is d * scale with d = q - p,
+// so a positive scale attracts. For a potential U(r) the scale is U'(r) / r. A law provides
+//   USES_DISTANCE            whether Scale needs r; otherwise r is not computed, and the range
+//                            checks compare squared distances
+//   Constants<S>             its coefficients in every lane, built once per kernel call from
+//                            PairParameters
+//   Scale<S>(r2, r, valid, lanes, constants)
+//                            the scale of every pair: valid marks the lanes in range (beyond
+//                            MIN_DISTANCE and within the cutoff), which should be the only
+//                            lanes with a non-zero scale
+// Scale is inlined into the pair loop, so a law costs no call or branch per pair.
+
+#include "CpuForceKernels.h"
+#include "Simulation.h"
+
+// e^x, relative error about 2e-7 (Cephes expf); x is clamped to [-87.3, 88.3]
+template <typename S>
+inline typename S::Float Exp(typename S::Float x)
+{
+	x = S::Min(S::Max(x, S::Set1(-87.3f)), S::Set1(88.3f));
+
+	// x = n ln 2 + f with |f| <= ln 2 / 2, ln 2 in two parts so n ln 2 is exact
+	typename S::Float n = S::Floor(S::Add(S::Mul(x, S::Set1(1.44269504f)), S::Set1(0.5f)));
+	typename S::Float f = S::Sub(S::Sub(x, S::Mul(n, S::Set1(0.693359375f))), S::Mul(n, S::Set1(-2.12194440e-4f)));
+
+	typename S::Float p = S::Set1(1.9875691500e-4f);
+	p = S::Add(S::Mul(p, f), S::Set1(1.3981999507e-3f));
+	p = S::Add(S::Mul(p, f), S::Set1(8.3334519073e-3f));
+	p = S::Add(S::Mul(p, f), S::Set1(4.1665795894e-2f));
+	p = S::Add(S::Mul(p, f), S::Set1(1.6666665459e-1f));
+	p = S::Add(S::Mul(p, f), S::Set1(5.0000001201e-1f));
+	p = S::Add(S::Add(S::Mul(S::Mul(p, f), f), f), S::Set1(1.0f));
+
+	return S::ScalePow2(p, n);
+}
+
+// calcForce of CSMain: k * (r - r0) / r
+struct SpringLaw
+{
+	static constexpr bool USES_DISTANCE = true;
+
+	template <typename S>
+	struct Constants
+	{
+		typename S::Float springK;
+		typename S::Float restLength;
+
+		explicit Constants(const PairParameters& pair)
+			: springK(S::Set1(pair.springK)), restLength(S::Set1(pair.restLength))
+		{
+		}
+	};
+
+	template <typename S>
+	static typename S::Float Scale(
+		typename S::Float, typename S::Float r, typename S::Mask valid, typename S::Mask, const Constants<S>& constants)
+	{
+		typename S::Float forceValue = S::Mul(constants.springK, S::Sub(r, constants.restLength));
+		return S::Select(valid, S::Div(forceValue, r));
+	}
+};
+
+// SpringLaw with r0 == 0: k, without square root or division
+struct LinearSpringLaw
+{
+	static constexpr bool USES_DISTANCE = false;
+
+	template <typename S>
+	struct Constants
+	{
+		typename S::Float springK;
+
+		explicit Constants(const PairParameters& pair) : springK(S::Set1(pair.springK)) {}
+	};
+
+	template <typename S>
+	static typename S::Float Scale(
+		typename S::Float, typename S::Float, typename S::Mask valid, typename S::Mask, const Constants<S>& constants)
+	{
+		return S::Select(valid, constants.springK);
+	}
+};
+
+// Only the rest length part of SpringLaw, -k * r0 / r, and -k for the pairs closer than
+// MIN_DISTANCE (see ForceKernel::restLengthTile)
+struct SpringRestLengthLaw
+{
+	static constexpr bool USES_DISTANCE = true;
+
+	template <typename S>
+	struct Constants
+	{
+		typename S::Float springK;
+		typename S::Float negativeSpringK;
+		typename S::Float restLength;
+
+		explicit Constants(const PairParameters& pair)
+			: springK(S::Set1(pair.springK)), negativeSpringK(S::Set1(-pair.springK)), restLength(S::Set1(pair.restLength))
+		{
+		}
+	};
+
+	template <typename S>
+	static typename S::Float Scale(
+		typename S::Float, typename S::Float r, typename S::Mask valid, typename S::Mask lanes, const Constants<S>& constants)
+	{
+		// -k * (r0 / r - 1) - k: -k * r0 / r on valid pairs, -k on the masked ones
+		typename S::Float rest = S::Sub(S::Div(constants.restLength, r), S::Set1(1.0f));
+		return S::Sub(S::Mul(constants.negativeSpringK, S::Select(valid, rest)), S::Select(lanes, constants.springK));
+	}
+};
+
+// U = 4 epsilon ((sigma / r)^12 - (sigma / r)^6): 24 epsilon s6 (1 - 2 s6) / r^2 with s6 = (sigma / r)^6
+struct LennardJonesLaw
+{
+	static constexpr bool USES_DISTANCE = false;
+
+	template <typename S>
+	struct Constants
+	{
+		typename S::Float epsilon24;
+		typename S::Float sigmaSquared;
+
+		explicit Constants(const PairParameters& pair)
+			: epsilon24(S::Set1(24.0f * pair.law.epsilon)), sigmaSquared(S::Set1(pair.law.sigma * pair.law.sigma))
+		{
+		}
+	};
+
+	template <typename S>
+	static typename S::Float Scale(
+		typename S::Float r2, typename S::Float, typename S::Mask valid, typename S::Mask, const Constants<S>& constants)
+	{
+		typename S::Float inverse2 = S::Div(S::Set1(1.0f), r2);
+		typename S::Float s2 = S::Mul(constants.sigmaSquared, inverse2);
+		typename S::Float s6 = S::Mul(S::Mul(s2, s2), s2);
+		typename S::Float shape = S::Mul(s6, S::Sub(S::Set1(1.0f), S::Add(s6, s6)));
+		return S::Select(valid, S::Mul(S::Mul(constants.epsilon24, shape), inverse2));
+	}
+};
+
+// U = -G / sqrt(r^2 + softening^2): G / (r^2 + softening^2)^(3/2)
+struct GravityLaw
+{
+	static constexpr bool USES_DISTANCE = false;
+
+	template <typename S>
+	struct Constants
+	{
+		typename S::Float strength;
+		typename S::Float softeningSquared;
+
+		explicit Constants(const PairParameters& pair)
+			: strength(S::Set1(pair.law.strength)), softeningSquared(S::Set1(pair.law.softening * pair.law.softening))
+		{
+		}
+	};
+
+	template <typename S>
+	static typename S::Float Scale(
+		typename S::Float r2, typename S::Float, typename S::Mask valid, typename S::Mask, const Constants<S>& constants)
+	{
+		typename S::Float inverse = S::Div(S::Set1(1.0f), S::Sqrt(S::Add(r2, constants.softeningSquared)));
+		return S::Select(valid, S::Mul(constants.strength, S::Mul(S::Mul(inverse, inverse), inverse)));
+	}
+};
+
+// U = D (1 - e^(-a (r - r0)))^2: 2 D a e (1 - e) / r with e = e^(-a (r - r0))
+struct MorseLaw
+{
+	static constexpr bool USES_DISTANCE = true;
+
+	template <typename S>
+	struct Constants
+	{
+		typename S::Float depthWidth2;
+		typename S::Float negativeWidth;
+		typename S::Float restLength;
+
+		explicit Constants(const PairParameters& pair)
+			: depthWidth2(S::Set1(2.0f * pair.law.depth * pair.law.width))
+			, negativeWidth(S::Set1(-pair.law.width))
+			, restLength(S::Set1(pair.restLength))
+		{
+		}
+	};
+
+	template <typename S>
+	static typename S::Float Scale(
+		typename S::Float, typename S::Float r, typename S::Mask valid, typename S::Mask, const Constants<S>& constants)
+	{
+		typename S::Float e = Exp<S>(S::Mul(constants.negativeWidth, S::Sub(r, constants.restLength)));
+		typename S::Float derivative = S::Mul(constants.depthWidth2, S::Mul(e, S::Sub(S::Set1(1.0f), e)));
+		return S::Select(valid, S::Div(derivative, r));
+	}
+};
+
+// ForceLaw::User, the place for a law of your own: it is built into every kernel like the
+// others. As shipped it is a soft-sphere repulsion, U = k / 2 (r0 - r)^2 for r < r0 and 0 beyond.
+struct UserForceLaw
+{
+	static constexpr bool USES_DISTANCE = true;
+
+	template <typename S>
+	struct Constants
+	{
+		typename S::Float springK;
+		typename S::Float restLength;
+
+		explicit Constants(const PairParameters& pair)
+			: springK(S::Set1(pair.springK)), restLength(S::Set1(pair.restLength))
+		{
+		}
+	};
+
+	template <typename S>
+	static typename S::Float Scale(
+		typename S::Float, typename S::Float r, typename S::Mask valid, typename S::Mask, const Constants<S>& constants)
+	{
+		typename S::Float forceValue = S::Mul(constants.springK, S::Sub(r, constants.restLength));
+		return S::Select(S::And(valid, S::Less(r, constants.restLength)), S::Div(forceValue, r));
+	}
+};
@@ -0,0 +1,1486 @@
+﻿#include "CpuSimulation.h"
+
+#include "HalfFloat.h"
+#include "RadixSort.h"
+
+#include <algorithm>
+#include <bit>
+#include <cfloat>
+#include <cmath>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+// Cells per chunk in ForceMode::CellList
+const size_t CELLS_PER_CHUNK = 64;
+
+// Points per chunk in ForceMode::Verlet
+const size_t VERLET_POINTS_PER_CHUNK = 256;
+
+// Points per octree leaf in ForceMode::BarnesHut
+const size_t BARNES_HUT_LEAF = 32;
+
+// Tile sizes are kept at multiples of the widest storage block and vector
+const size_t TILE_ALIGNMENT = 16;
+
+// Points per chunk for the linear passes: splitting positions, integration, reductions
+const size_t LINEAR_PER_CHUNK = 16384;
+
+// Points per block in ForceMode::Symmetric; positions and forces of two blocks stay in L1
+const size_t SYMMETRIC_BLOCK = 256;
+
+namespace
+{
+	size_t RoundUpToTile(size_t size)
+	{
+		return (size + TILE_ALIGNMENT - 1) / TILE_ALIGNMENT * TILE_ALIGNMENT;
+	}
+
+	// VSMain and GSMain for the point with this id. VSMain currently ignores the point and
+	// writes (id, 2, 3, 4); GSMain passes it through.
+	void ShadeVertex(size_t id, Vertex& vertex)
+	{
+		vertex.position[0] = static_cast<float>(id);
+		vertex.position[1] = 2.0f;
+		vertex.position[2] = 3.0f;
+		vertex.position[3] = 4.0f;
+	}
+
+	// Outputs of the fused step, one point and one vertex per simulated point
+	void CheckFusedOutputs(const std::vector<Point>& points, const std::vector<Vertex>& vertexes, size_t count)
+	{
+		if (points.size() != count || vertexes.size() != count)
+		{
+			throw std::invalid_argument("Output point or vertex count does not match point count");
+		}
+	}
+}
+
+const char* ForceModeName(ForceMode mode)
+{
+	switch (mode)
+	{
+	case ForceMode::AllPairs: return "all-pairs";
+	case ForceMode::Symmetric: return "symmetric";
+	case ForceMode::CellList: return "cell-list";
+	case ForceMode::Verlet: return "verlet";
+	case ForceMode::Centroid: return "centroid";
+	case ForceMode::BarnesHut: return "barnes-hut";
+	}
+	return "unknown";
+}
+
+const char* IntegratorName(Integrator integrator)
+{
+	switch (integrator)
+	{
+	case Integrator::Euler: return "euler";
+	case Integrator::Leapfrog: return "leapfrog";
+	case Integrator::VelocityVerlet: return "velocity-verlet";
+	case Integrator::Rk4: return "rk4";
+	}
+	return "unknown";
+}
+
+CpuSimulation::CpuSimulation(ThreadPool& pool, const std::vector<Point>& points, const CpuSimulationOptions& options,
+	const std::vector<float>& masses)
+	: m_pool(pool)
+	, m_options(options)
+	, m_pair{ options.parameters.springK, options.parameters.restLength, options.cutoff > 0.0f ? options.cutoff : FLT_MAX, options.law }
+	, m_massModel(!masses.empty() ? MassModel::PerPoint : options.parameters.mass == 1.0f ? MassModel::Unit : MassModel::Uniform)
+	, m_bufferA(points.size(), options.layout)
+	, m_bufferB(points.size(), options.layout)
+	, m_forceX(points.size())
+	, m_forceY(points.size())
+	, m_forceZ(points.size())
+{
+	if ((m_options.forceMode == ForceMode::CellList || m_options.forceMode == ForceMode::Verlet) && !(m_options.cutoff > 0.0f))
+	{
+		throw std::invalid_argument(std::string(ForceModeName(m_options.forceMode)) + " force mode needs a positive cutoff");
+	}
+	if ((m_options.forceMode == ForceMode::Centroid || m_options.forceMode == ForceMode::BarnesHut) && m_options.cutoff > 0.0f)
+	{
+		// With a cutoff the linear part is no longer a sum over all points
+		throw std::invalid_argument(std::string(ForceModeName(m_options.forceMode)) + " force mode does not support a cutoff");
+	}
+	if ((m_options.forceMode == ForceMode::Centroid || m_options.forceMode == ForceMode::BarnesHut) && m_options.forceLaw != ForceLaw::Spring)
+	{
+		throw std::invalid_argument(std::string(ForceModeName(m_options.forceMode)) + " force mode only supports the spring force law");
+	}
+	if (m_options.forceMode == ForceMode::Symmetric && m_options.accumulation != ForceAccumulation::Float)
+	{
+		throw std::invalid_argument("symmetric force mode only accumulates in float");
+	}
+	if (m_options.halfPositions && m_options.forceMode != ForceMode::AllPairs)
+	{
+		throw std::invalid_argument("Half precision positions are only streamed by the all-pairs force mode");
+	}
+	if (m_options.forceMode == ForceMode::BarnesHut && !(m_options.theta >= 0.0f))
+	{
+		throw std::invalid_argument("Barnes-Hut opening angle must not be negative");
+	}
+
+	if (!masses.empty() && masses.size() != points.size())
+	{
+		throw std::invalid_argument("Mass count does not match point count");
+	}
+
+	if (!m_options.kernel) m_options.kernel = &BestForceKernel();
+	const ForceLawKernels& lawKernels = m_options.kernel->Law(m_options.forceLaw, m_options.parameters.restLength, m_options.accumulation);
+	m_tile = lawKernels.tile;
+	m_halfTile = lawKernels.halfTile;
+	m_symmetricTile = lawKernels.symmetricTile;
+	m_restLengthTile = m_options.kernel->restLengthTile[static_cast<size_t>(m_options.accumulation)];
+	m_options.tileI = RoundUpToTile(std::max<size_t>(1, m_options.tileI));
+	m_options.tileJ = RoundUpToTile(m_options.tileJ);
+
+	// A single j tile is summed by the kernel alone
+	m_sumTiles = m_options.accumulation != ForceAccumulation::Float && m_options.tileJ && m_options.tileJ < points.size();
+	if (m_sumTiles)
+	{
+		m_workerTileSums.assign(m_pool.ThreadCount(), std::vector<double>(m_options.tileI * 3));
+	}
+
+	if (m_options.halfPositions)
+	{
+		m_halfX.resize(points.size());
+		m_halfY.resize(points.size());
+		m_halfZ.resize(points.size());
+		m_workerSelf.assign(m_pool.ThreadCount(), std::vector<size_t>(m_options.tileI));
+	}
+
+	m_pool.ParallelFor(points.size(), LINEAR_PER_CHUNK, [&](size_t begin, size_t end, size_t)
+		{
+			for (size_t index = begin; index < end; ++index)
+			{
+				m_bufferA.Set(index, points[index]);
+				m_bufferB.Set(index, points[index]);
+			}
+		});
+	m_masses = masses;
+
+	// The symmetric kernel takes contiguous blocks of positions
+	m_gather = m_options.layout == PointLayout::Aos || (m_options.forceMode == ForceMode::Symmetric && m_options.layout != PointLayout::Soa);
+	if (m_gather)
+	{
+		m_x.resize(points.size());
+		m_y.resize(points.size());
+		m_z.resize(points.size());
+	}
+
+	if (m_options.forceMode == ForceMode::Symmetric)
+	{
+		size_t blocks = (points.size() + SYMMETRIC_BLOCK - 1) / SYMMETRIC_BLOCK;
+		if (m_options.deterministic)
+		{
+			// Every block with itself, then the rounds of a round-robin tournament (circle method):
+			// block rounds - 1 stays, the others rotate, and every round pairs them up from both
+			// ends. An odd count gets a dummy block, whose partner sits the round out.
+			m_roundBegin.push_back(0);
+			for (size_t i = 0; i < blocks; ++i)
+			{
+				m_blockPairs.emplace_back(i, i);
+			}
+
+			size_t players = blocks + blocks % 2;
+			for (size_t round = 0; round + 1 < players; ++round)
+			{
+				m_roundBegin.push_back(m_blockPairs.size());
+				for (size_t k = 0; k < players / 2; ++k)
+				{
+					size_t i = k ? (round + k) % (players - 1) : players - 1;
+					size_t j = k ? (round + players - 1 - k) % (players - 1) : round;
+					if (i < blocks && j < blocks) m_blockPairs.emplace_back(std::min(i, j), std::max(i, j));
+				}
+			}
+			m_roundBegin.push_back(m_blockPairs.size());
+		}
+		else
+		{
+			for (size_t i = 0; i < blocks; ++i)
+			{
+				for (size_t j = i; j < blocks; ++j)
+				{
+					m_blockPairs.emplace_back(i, j);
+				}
+			}
+
+			m_workerForces.assign(m_pool.ThreadCount(), std::vector<float>(points.size() * 3, 0.0f));
+			m_workerUsed.assign(m_pool.ThreadCount(), 0);
+		}
+	}
+
+	if (m_options.forceMode == ForceMode::CellList || m_options.forceMode == ForceMode::BarnesHut)
+	{
+		m_sortedForceX.resize(points.size());
+		m_sortedForceY.resize(points.size());
+		m_sortedForceZ.resize(points.size());
+	}
+
+	if (m_options.forceMode == ForceMode::Centroid || m_options.forceMode == ForceMode::BarnesHut)
+	{
+		m_chunkPositionSums.resize((points.size() + LINEAR_PER_CHUNK - 1) / LINEAR_PER_CHUNK);
+	}
+
+	if (m_options.forceMode == ForceMode::BarnesHut)
+	{
+		m_workerStacks.resize(m_pool.ThreadCount());
+		m_workerFarNodes.resize(m_pool.ThreadCount());
+	}
+
+	if (m_options.forceMode == ForceMode::Verlet)
+	{
+		m_verlet.emplace(m_options.cutoff, m_options.skin);
+		m_workerNeighbors.resize(m_pool.ThreadCount());
+	}
+
+	m_timeStep = m_previousTimeStep = m_options.parameters.timeStep;
+
+	const AdaptiveTimeStep& adaptive = m_options.adaptiveTimeStep;
+	if (adaptive.enabled)
+	{
+		if (!(adaptive.minTimeStep > 0.0f && adaptive.minTimeStep <= adaptive.maxTimeStep))
+		{
+			throw std::invalid_argument("Adaptive time step needs 0 < minTimeStep <= maxTimeStep");
+		}
+		if (!(adaptive.accuracy > 0.0f && adaptive.length > 0.0f))
+		{
+			throw std::invalid_argument("Adaptive time step needs a positive accuracy and length");
+		}
+		m_workerExtremes.resize(m_pool.ThreadCount());
+	}
+
+	const BlockTimeSteps& block = m_options.blockTimeSteps;
+	if (block.enabled)
+	{
+		if (m_options.integrator != Integrator::VelocityVerlet)
+		{
+			throw std::invalid_argument("Block time steps need the velocity Verlet integrator");
+		}
+		if (adaptive.enabled)
+		{
+			throw std::invalid_argument("Block time steps do not combine with the adaptive time step");
+		}
+		if (!(block.levels >= 1 && block.levels <= MAX_BLOCK_LEVELS))
+		{
+			throw std::invalid_argument("Block time steps need 1 to " + std::to_string(MAX_BLOCK_LEVELS) + " levels");
+		}
+		if (!(block.accuracy > 0.0f && block.length > 0.0f))
+		{
+			throw std::invalid_argument("Block time steps need a positive accuracy and length");
+		}
+
+		m_levels.resize(points.size());
+		m_workerLevelCounts.resize(m_pool.ThreadCount());
+		if (m_options.forceMode == ForceMode::AllPairs)
+		{
+			m_active.reserve(points.size());
+			m_activeX.resize(points.size());
+			m_activeY.resize(points.size());
+			m_activeZ.resize(points.size());
+			m_activeForceX.resize(points.size());
+			m_activeForceY.resize(points.size());
+			m_activeForceZ.resize(points.size());
+		}
+	}
+
+	if (m_options.integrator == Integrator::Rk4)
+	{
+		m_rkSum = PointBuffer(points.size(), m_options.layout);
+	}
+
+	if (m_options.order != CurveOrder::None)
+	{
+		m_order.resize(points.size());
+		std::iota(m_order.begin(), m_order.end(), size_t(0));
+		Reorder();
+	}
+}
+
+void CpuSimulation::RunCompute()
+{
+	ComputeForces();
+	Advance();
+}
+
+void CpuSimulation::RunCompute(size_t steps)
+{
+	if (steps == 0) return;
+
+	ThreadPool::KeepAwake awake(m_pool);
+	for (size_t step = 0; step < steps; ++step)
+	{
+		RunCompute();
+	}
+}
+
+void CpuSimulation::ComputeForces()
+{
+	if (!m_order.empty() && m_options.reorderInterval && m_stepsSinceReorder >= m_options.reorderInterval)
+	{
+		Reorder();
+	}
+	++m_stepsSinceReorder;
+
+	if (!m_forcesCurrent)
+	{
+		EvaluateForces();
+	}
+}
+
+void CpuSimulation::EvaluateForces()
+{
+	if (m_gather)
+	{
+		m_pool.ParallelFor(PointsCount(), LINEAR_PER_CHUNK, [this](size_t begin, size_t end, size_t)
+			{
+				GatherPositions(begin, end);
+			});
+	}
+
+	if (m_options.halfPositions)
+	{
+		m_pool.ParallelFor(PointsCount(), LINEAR_PER_CHUNK, [this](size_t begin, size_t end, size_t)
+			{
+				ConvertHalfPositions(begin, end);
+			});
+	}
+
+	switch (m_options.forceMode)
+	{
+	case ForceMode::AllPairs:
+		m_pool.ParallelFor(PointsCount(), m_options.tileI, [this](size_t begin, size_t end, size_t worker)
+			{
+				ComputeAllPairs(begin, end, worker, m_tile, m_options.halfPositions ? m_halfTile : nullptr);
+			});
+		break;
+	case ForceMode::Centroid:
+		SumPositions();
+		m_pool.ParallelFor(PointsCount(), m_options.tileI, [this](size_t begin, size_t end, size_t worker)
+			{
+				ComputeAllPairs(begin, end, worker, m_restLengthTile);
+				AddLinearTerm(begin, end);
+			});
+		break;
+	case ForceMode::Symmetric:
+		ComputeSymmetric();
+		break;
+	case ForceMode::CellList:
+		ComputeCellList();
+		break;
+	case ForceMode::Verlet:
+		ComputeVerlet();
+		break;
+	case ForceMode::BarnesHut:
+		ComputeBarnesHut();
+		break;
+	}
+}
+
+void CpuSimulation::Advance()
+{
+	AdvanceAndEmit(nullptr, nullptr);
+}
+
+void CpuSimulation::RunComputeFused(std::vector<Point>& points, std::vector<Vertex>& vertexes)
+{
+	CheckFusedOutputs(points, vertexes, PointsCount());
+	ComputeForces();
+	AdvanceFused(points, vertexes);
+}
+
+void CpuSimulation::AdvanceFused(std::vector<Point>& points, std::vector<Vertex>& vertexes)
+{
+	CheckFusedOutputs(points, vertexes, PointsCount());
+	AdvanceAndEmit(points.data(), vertexes.data());
+}
+
+void CpuSimulation::AdvanceAndEmit(Point* points, Vertex* vertexes)
+{
+	m_forcesCurrent = false;
+	m_previousTimeStep = m_timeStep;
+	m_timeStep = ChooseTimeStep();
+	m_time += m_timeStep;
+
+	if (m_options.blockTimeSteps.enabled)
+	{
+		AdvanceBlockSteps();
+	}
+	else switch (m_options.integrator)
+	{
+	case Integrator::Euler:
+		// Emits the points itself
+		AdvanceEuler(points, vertexes);
+		return;
+	case Integrator::Leapfrog:
+		AdvanceLeapfrog();
+		break;
+	case Integrator::VelocityVerlet:
+		AdvanceVelocityVerlet();
+		break;
+	case Integrator::Rk4:
+		AdvanceRk4();
+		break;
+	}
+
+	if (points)
+	{
+		m_pool.ParallelFor(PointsCount(), LINEAR_PER_CHUNK, [&](size_t begin, size_t end, size_t)
+			{
+				for (size_t slot = begin; slot < end; ++slot)
+				{
+					EmitPoint(slot, m_read->Get(slot), points, vertexes);
+				}
+			});
+	}
+}
+
+void CpuSimulation::EmitPoint(size_t slot, const Point& point, Point* points, Vertex* vertexes) const
+{
+	size_t id = m_order.empty() ? slot : m_order[slot];
+	points[id] = point;
+	ShadeVertex(id, vertexes[id]);
+}
+
+void CpuSimulation::Reorder()
+{
+	float lower[3];
+	float size;
+	BoundingCube(m_pool, *m_read, lower, size);
+	ComputeCurveKeys(m_pool, *m_read, m_options.order, lower, size, m_curveKeys);
+
+	m_reorderSlots.resize(PointsCount());
+	std::iota(m_reorderSlots.begin(), m_reorderSlots.end(), size_t(0));
+	RadixSortByKey(m_pool, m_curveKeys, m_reorderSlots, 3 * CURVE_BITS);
+
+	// Slot i of the new order takes the point in slot m_reorderSlots[i]; the write buffer is free
+	// until the next step, so the sorted points go there and the buffers are swapped
+	std::vector<size_t> order(PointsCount());
+	std::vector<float> masses(m_masses.size());
+	m_pool.ParallelFor(PointsCount(), LINEAR_PER_CHUNK, [&](size_t begin, size_t end, size_t)
+		{
+			for (size_t slot = begin; slot < end; ++slot)
+			{
+				size_t from = m_reorderSlots[slot];
+				m_write->Set(slot, m_read->Get(from));
+				order[slot] = m_order[from];
+				if (!masses.empty()) masses[slot] = m_masses[from];
+			}
+		});
+
+	m_order = std::move(order);
+	m_masses = std::move(masses);
+	std::swap(m_read, m_write);
+	m_stepsSinceReorder = 0;
+
+	// Forces are kept per slot
+	m_forcesCurrent = false;
+
+	// Neighbor lists hold slots, not original indices
+	if (m_verlet) m_verlet->Invalidate();
+}
+
+void CpuSimulation::GatherPositions(size_t begin, size_t end)
+{
+	for (size_t index = begin; index < end; ++index)
+	{
+		m_x[index] = m_read->At(index, 0);
+		m_y[index] = m_read->At(index, 1);
+		m_z[index] = m_read->At(index, 2);
+	}
+}
+
+void CpuSimulation::ConvertHalfPositions(size_t begin, size_t end)
+{
+	for (size_t index = begin; index < end; ++index)
+	{
+		m_halfX[index] = FloatToHalf(m_read->At(index, 0));
+		m_halfY[index] = FloatToHalf(m_read->At(index, 1));
+		m_halfZ[index] = FloatToHalf(m_read->At(index, 2));
+	}
+}
+
+PositionStream CpuSimulation::CurrentPositions() const
+{
+	if (m_gather)
+	{
+		return { m_x.data(), m_y.data(), m_z.data(), PointsCount(), 0 };
+	}
+	return m_read->Positions();
+}
+
+HalfPositionStream CpuSimulation::HalfPositions() const
+{
+	return { m_halfX.data(), m_halfY.data(), m_halfZ.data(), std::max<size_t>(1, PointsCount()), 0 };
+}
+
+void CpuSimulation::ComputeAllPairs(size_t begin, size_t end, size_t worker, ForceTileFunction tileFunction,
+	ForceHalfTileFunction halfTileFunction)
+{
+	PositionStream positions = CurrentPositions();
+	size_t count = PointsCount();
+	size_t tileJ = m_options.tileJ ? m_options.tileJ : count;
+
+	std::fill(m_forceX.begin() + begin, m_forceX.begin() + end, 0.0f);
+	std::fill(m_forceY.begin() + begin, m_forceY.begin() + end, 0.0f);
+	std::fill(m_forceZ.begin() + begin, m_forceZ.begin() + end, 0.0f);
+
+	for (size_t tile = 0; tile < count; tile += tileJ)
+	{
+		PositionStream tilePositions = SlicePositions(positions, tile);
+		size_t tileCount = std::min(tileJ, count - tile);
+
+		// The i-block handed to the kernel must not cross a storage block
+		for (size_t first = begin; first < end; )
+		{
+			size_t lane = first % positions.blockSize;
+			size_t last = std::min(end, first - lane + positions.blockSize);
+			PositionStream iPositions = SlicePositions(positions, first);
+
+			if (halfTileFunction)
+			{
+				// Wraps past tileCount for the points before the tile
+				size_t* self = m_workerSelf[worker].data();
+				for (size_t index = first; index < last; ++index) self[index - first] = index - tile;
+
+				halfTileFunction(
+					iPositions.x, iPositions.y, iPositions.z, last - first,
+					SlicePositions(HalfPositions(), tile), tileCount, m_pair, self,
+					m_forceX.data() + first, m_forceY.data() + first, m_forceZ.data() + first);
+			}
+			else
+			{
+				tileFunction(
+					iPositions.x, iPositions.y, iPositions.z, last - first,
+					tilePositions, tileCount, m_pair,
+					m_forceX.data() + first, m_forceY.data() + first, m_forceZ.data() + first);
+			}
+
+			first = last;
+		}
+
+		if (m_sumTiles)
+		{
+			AddTileSums(worker, end - begin, m_forceX.data() + begin, m_forceY.data() + begin, m_forceZ.data() + begin);
+		}
+	}
+
+	if (m_sumTiles)
+	{
+		StoreTileSums(worker, end - begin, m_forceX.data() + begin, m_forceY.data() + begin, m_forceZ.data() + begin);
+	}
+}
+
+void CpuSimulation::AddTileSums(size_t worker, size_t count, float* fx, float* fy, float* fz)
+{
+	double* sums = m_workerTileSums[worker].data();
+	for (size_t index = 0; index < count; ++index)
+	{
+		sums[index * 3 + 0] += fx[index];
+		sums[index * 3 + 1] += fy[index];
+		sums[index * 3 + 2] += fz[index];
+		fx[index] = fy[index] = fz[index] = 0.0f;
+	}
+}
+
+void CpuSimulation::StoreTileSums(size_t worker, size_t count, float* fx, float* fy, float* fz)
+{
+	double* sums = m_workerTileSums[worker].data();
+	for (size_t index = 0; index < count; ++index)
+	{
+		fx[index] = static_cast<float>(sums[index * 3 + 0]);
+		fy[index] = static_cast<float>(sums[index * 3 + 1]);
+		fz[index] = static_cast<float>(sums[index * 3 + 2]);
+		sums[index * 3 + 0] = sums[index * 3 + 1] = sums[index * 3 + 2] = 0.0;
+	}
+}
+
+void CpuSimulation::SumPositions()
+{
+	PositionStream positions = CurrentPositions();
+
+	m_pool.ParallelFor(PointsCount(), LINEAR_PER_CHUNK, [&](size_t begin, size_t end, size_t)
+		{
+			double sum[3] = {};
+			for (size_t index = begin; index < end; ++index)
+			{
+				PositionStream point = SlicePositions(positions, index);
+				sum[0] += *point.x;
+				sum[1] += *point.y;
+				sum[2] += *point.z;
+			}
+			for (int c = 0; c < 3; ++c) m_chunkPositionSums[begin / LINEAR_PER_CHUNK][c] = sum[c];
+		});
+
+	for (int c = 0; c < 3; ++c)
+	{
+		m_positionSum[c] = 0.0;
+		for (const auto& sum : m_chunkPositionSums) m_positionSum[c] += sum[c];
+	}
+}
+
+void CpuSimulation::AddLinearTerm(size_t begin, size_t end)
+{
+	// Sum over j of k * (p_j - p_i) = k * (sum - N * p_i); the self pair adds nothing
+	PositionStream positions = CurrentPositions();
+	double count = static_cast<double>(PointsCount());
+	float* force[3] = { m_forceX.data(), m_forceY.data(), m_forceZ.data() };
+
+	for (size_t index = begin; index < end; ++index)
+	{
+		PositionStream point = SlicePositions(positions, index);
+		const float* position[3] = { point.x, point.y, point.z };
+		for (int c = 0; c < 3; ++c)
+		{
+			force[c][index] += static_cast<float>(m_pair.springK * (m_positionSum[c] - count * *position[c]));
+		}
+	}
+}
+
+void CpuSimulation::ComputeSymmetric()
+{
+	PositionStream positions = CurrentPositions();
+	size_t count = PointsCount();
+
+	if (m_options.deterministic)
+	{
+		// No block is in two pairs of a round, so the pairs of a round can write the forces directly
+		m_pool.ParallelFor(count, LINEAR_PER_CHUNK, [&](size_t begin, size_t end, size_t)
+			{
+				std::fill(m_forceX.begin() + begin, m_forceX.begin() + end, 0.0f);
+				std::fill(m_forceY.begin() + begin, m_forceY.begin() + end, 0.0f);
+				std::fill(m_forceZ.begin() + begin, m_forceZ.begin() + end, 0.0f);
+			});
+
+		for (size_t round = 0; round + 1 < m_roundBegin.size(); ++round)
+		{
+			size_t first = m_roundBegin[round];
+			m_pool.ParallelFor(m_roundBegin[round + 1] - first, 1, [&](size_t begin, size_t end, size_t)
+				{
+					for (size_t pair = first + begin; pair < first + end; ++pair)
+					{
+						size_t i = m_blockPairs[pair].first * SYMMETRIC_BLOCK;
+						size_t j = m_blockPairs[pair].second * SYMMETRIC_BLOCK;
+
+						m_symmetricTile(
+							positions.x + i, positions.y + i, positions.z + i, std::min(SYMMETRIC_BLOCK, count - i),
+							positions.x + j, positions.y + j, positions.z + j, std::min(SYMMETRIC_BLOCK, count - j), m_pair,
+							i == j,
+							m_forceX.data() + i, m_forceY.data() + i, m_forceZ.data() + i,
+							m_forceX.data() + j, m_forceY.data() + j, m_forceZ.data() + j);
+					}
+				});
+		}
+		return;
+	}
+
+	std::fill(m_workerUsed.begin(), m_workerUsed.end(), 0);
+
+	m_pool.ParallelFor(m_blockPairs.size(), 1, [&](size_t begin, size_t end, size_t worker)
+		{
+			m_workerUsed[worker] = 1;
+			float* fx = m_workerForces[worker].data();
+			float* fy = fx + count;
+			float* fz = fy + count;
+
+			for (size_t pair = begin; pair < end; ++pair)
+			{
+				size_t i = m_blockPairs[pair].first * SYMMETRIC_BLOCK;
+				size_t j = m_blockPairs[pair].second * SYMMETRIC_BLOCK;
+
+				m_symmetricTile(
+					positions.x + i, positions.y + i, positions.z + i, std::min(SYMMETRIC_BLOCK, count - i),
+					positions.x + j, positions.y + j, positions.z + j, std::min(SYMMETRIC_BLOCK, count - j), m_pair,
+					i == j,
+					fx + i, fy + i, fz + i,
+					fx + j, fy + j, fz + j);
+			}
+		});
+
+	// Sum the worker accumulators and clear them for the next step
+	m_pool.ParallelFor(count, LINEAR_PER_CHUNK, [&](size_t begin, size_t end, size_t)
+		{
+			std::fill(m_forceX.begin() + begin, m_forceX.begin() + end, 0.0f);
+			std::fill(m_forceY.begin() + begin, m_forceY.begin() + end, 0.0f);
+			std::fill(m_forceZ.begin() + begin, m_forceZ.begin() + end, 0.0f);
+
+			for (size_t worker = 0; worker < m_workerForces.size(); ++worker)
+			{
+				if (!m_workerUsed[worker]) continue;
+
+				float* fx = m_workerForces[worker].data();
+				float* fy = fx + count;
+				float* fz = fy + count;
+				for (size_t index = begin; index < end; ++index)
+				{
+					m_forceX[index] += fx[index];
+					m_forceY[index] += fy[index];
+					m_forceZ[index] += fz[index];
+					fx[index] = fy[index] = fz[index] = 0.0f;
+				}
+			}
+		});
+}
+
+void CpuSimulation::ComputeCellList()
+{
+	m_cellList.Build(m_pool, *m_read, m_options.cutoff);
+
+	PositionStream positions = m_cellList.SortedPositions();
+	const auto& dimensions = m_cellList.Dimensions();
+
+	m_pool.ParallelFor(m_cellList.CellCount(), CELLS_PER_CHUNK, [&](size_t begin, size_t end, size_t)
+		{
+			for (size_t cell = begin; cell < end; ++cell)
+			{
+				size_t first = m_cellList.CellBegin(cell);
+				size_t last = m_cellList.CellBegin(cell + 1);
+				if (first == last) continue;
+
+				std::fill(m_sortedForceX.begin() + first, m_sortedForceX.begin() + last, 0.0f);
+				std::fill(m_sortedForceY.begin() + first, m_sortedForceY.begin() + last, 0.0f);
+				std::fill(m_sortedForceZ.begin() + first, m_sortedForceZ.begin() + last, 0.0f);
+
+				size_t x = cell % dimensions[0];
+				size_t y = cell / dimensions[0] % dimensions[1];
+				size_t z = cell / dimensions[0] / dimensions[1];
+
+				// The three neighbors along x are contiguous in sorted order: one kernel call per row
+				size_t x0 = x > 0 ? x - 1 : x;
+				size_t x1 = x + 1 < dimensions[0] ? x + 1 : x;
+				for (size_t nz = z > 0 ? z - 1 : z; nz <= z + 1 && nz < dimensions[2]; ++nz)
+				{
+					for (size_t ny = y > 0 ? y - 1 : y; ny <= y + 1 && ny < dimensions[1]; ++ny)
+					{
+						size_t rowFirst = m_cellList.CellBegin(m_cellList.Cell(x0, ny, nz));
+						size_t rowLast = m_cellList.CellBegin(m_cellList.Cell(x1, ny, nz) + 1);
+						if (rowFirst == rowLast) continue;
+
+						m_tile(
+							positions.x + first, positions.y + first, positions.z + first, last - first,
+							SlicePositions(positions, rowFirst), rowLast - rowFirst, m_pair,
+							m_sortedForceX.data() + first, m_sortedForceY.data() + first, m_sortedForceZ.data() + first);
+					}
+				}
+			}
+		});
+
+	// Back to the original point order
+	m_pool.ParallelFor(PointsCount(), LINEAR_PER_CHUNK, [&](size_t begin, size_t end, size_t)
+		{
+			for (size_t sorted = begin; sorted < end; ++sorted)
+			{
+				size_t index = m_cellList.SortedIndex(sorted);
+				m_forceX[index] = m_sortedForceX[sorted];
+				m_forceY[index] = m_sortedForceY[sorted];
+				m_forceZ[index] = m_sortedForceZ[sorted];
+			}
+		});
+}
+
+void CpuSimulation::ComputeVerlet()
+{
+	if (m_verlet->Update(m_pool, *m_read))
+	{
+		for (auto& neighbors : m_workerNeighbors)
+		{
+			neighbors.resize(std::max<size_t>(1, m_verlet->MaxNeighbors()) * 3);
+		}
+	}
+
+	PositionStream positions = CurrentPositions();
+
+	m_pool.ParallelFor(PointsCount(), VERLET_POINTS_PER_CHUNK, [&](size_t begin, size_t end, size_t worker)
+		{
+			float* nx = m_workerNeighbors[worker].data();
+			float* ny = nx + m_verlet->MaxNeighbors();
+			float* nz = ny + m_verlet->MaxNeighbors();
+
+			for (size_t sorted = begin; sorted < end; ++sorted)
+			{
+				size_t index = m_verlet->Index(sorted);
+				const size_t* first = m_verlet->Neighbors() + m_verlet->NeighborBegin(sorted);
+				size_t count = m_verlet->NeighborBegin(sorted + 1) - m_verlet->NeighborBegin(sorted);
+
+				// Listed neighbors into contiguous arrays, then one kernel call with a single-point i-block
+				for (size_t n = 0; n < count; ++n)
+				{
+					PositionStream neighbor = SlicePositions(positions, first[n]);
+					nx[n] = *neighbor.x;
+					ny[n] = *neighbor.y;
+					nz[n] = *neighbor.z;
+				}
+
+				m_forceX[index] = m_forceY[index] = m_forceZ[index] = 0.0f;
+
+				PositionStream point = SlicePositions(positions, index);
+				m_tile(
+					point.x, point.y, point.z, 1,
+					{ nx, ny, nz, std::max<size_t>(1, count), 0 }, count, m_pair,
+					&m_forceX[index], &m_forceY[index], &m_forceZ[index]);
+			}
+		});
+}
+
+void CpuSimulation::ComputeBarnesHut()
+{
+	SumPositions();
+	m_octree.Build(m_pool, *m_read, BARNES_HUT_LEAF);
+
+	PositionStream positions = m_octree.SortedPositions();
+	const auto& nodes = m_octree.Nodes();
+	const auto& leaves = m_octree.Leaves();
+	float theta = m_options.theta;
+	float farScale = -m_pair.springK * m_pair.restLength;
+
+	// One interaction list per leaf: near leaves exactly with the rest length kernel, far nodes
+	// from their centroid. The linear part is exact for every pair and added afterwards.
+	m_pool.ParallelFor(leaves.size(), 1, [&](size_t begin, size_t end, size_t worker)
+		{
+			auto& stack = m_workerStacks[worker];
+			auto& farNodes = m_workerFarNodes[worker];
+
+			for (size_t leafIndex = begin; leafIndex < end; ++leafIndex)
+			{
+				const OctreeNode& leaf = nodes[leaves[leafIndex]];
+				size_t first = leaf.first;
+				size_t last = leaf.first + leaf.count;
+
+				std::fill(m_sortedForceX.begin() + first, m_sortedForceX.begin() + last, 0.0f);
+				std::fill(m_sortedForceY.begin() + first, m_sortedForceY.begin() + last, 0.0f);
+				std::fill(m_sortedForceZ.begin() + first, m_sortedForceZ.begin() + last, 0.0f);
+
+				// Every point of the leaf is within radius of its cube's center
+				float center[3];
+				for (int c = 0; c < 3; ++c) center[c] = leaf.lower[c] + 0.5f * leaf.size;
+				float radius = 0.8660254f * leaf.size;
+
+				farNodes.clear();
+				stack.assign(1, 0);
+				while (!stack.empty())
+				{
+					const OctreeNode& node = nodes[stack.back()];
+					stack.pop_back();
+
+					// Ancestors of the leaf are always opened
+					bool containsLeaf = node.first <= first && first < node.first + node.count;
+					if (!containsLeaf)
+					{
+						float dx = node.centroid[0] - center[0];
+						float dy = node.centroid[1] - center[1];
+						float dz = node.centroid[2] - center[2];
+						float distance = std::sqrt(dx * dx + dy * dy + dz * dz) - radius;
+						if (distance > 0.0f && node.size < theta * distance)
+						{
+							farNodes.push_back(&node - nodes.data());
+							continue;
+						}
+					}
+
+					if (node.childCount)
+					{
+						for (size_t child = node.child; child < node.child + node.childCount; ++child) stack.push_back(child);
+						continue;
+					}
+
+					m_restLengthTile(
+						positions.x + first, positions.y + first, positions.z + first, leaf.count,
+						SlicePositions(positions, node.first), node.count, m_pair,
+						m_sortedForceX.data() + first, m_sortedForceY.data() + first, m_sortedForceZ.data() + first);
+				}
+
+				for (size_t sorted = first; sorted < last; ++sorted)
+				{
+					float fx = 0.0f;
+					float fy = 0.0f;
+					float fz = 0.0f;
+					for (size_t far : farNodes)
+					{
+						const OctreeNode& node = nodes[far];
+						float dx = node.centroid[0] - positions.x[sorted];
+						float dy = node.centroid[1] - positions.y[sorted];
+						float dz = node.centroid[2] - positions.z[sorted];
+						float r = std::sqrt(dx * dx + dy * dy + dz * dz);
+
+						// count times -k * r0 * d / r
+						float scale = farScale * static_cast<float>(node.count) / r;
+						fx += dx * scale;
+						fy += dy * scale;
+						fz += dz * scale;
+					}
+					m_sortedForceX[sorted] += fx;
+					m_sortedForceY[sorted] += fy;
+					m_sortedForceZ[sorted] += fz;
+				}
+			}
+		});
+
+	m_pool.ParallelFor(PointsCount(), LINEAR_PER_CHUNK, [&](size_t begin, size_t end, size_t)
+		{
+			for (size_t sorted = begin; sorted < end; ++sorted)
+			{
+				size_t index = m_octree.SortedIndex(sorted);
+				m_forceX[index] = m_sortedForceX[sorted];
+				m_forceY[index] = m_sortedForceY[sorted];
+				m_forceZ[index] = m_sortedForceZ[sorted];
+			}
+		});
+
+	m_pool.ParallelFor(PointsCount(), LINEAR_PER_CHUNK, [this](size_t begin, size_t end, size_t)
+		{
+			AddLinearTerm(begin, end);
+		});
+}
+
+float CpuSimulation::ChooseTimeStep()
+{
+	const AdaptiveTimeStep& adaptive = m_options.adaptiveTimeStep;
+	if (!adaptive.enabled) return m_options.parameters.timeStep;
+
+	// Largest squared acceleration and velocity, from the forces of this step
+	std::fill(m_workerExtremes.begin(), m_workerExtremes.end(), std::array<float, 2>{});
+	ForEachChunk([&](auto model, size_t begin, size_t end, size_t worker)
+		{
+			float maxAcceleration = 0.0f;
+			float maxVelocity = 0.0f;
+			for (size_t index = begin; index < end; ++index)
+			{
+				float acceleration = 0.0f;
+				float velocity = 0.0f;
+				for (int c = 0; c < 3; ++c)
+				{
+					float a = Acceleration<decltype(model)::value>(c, index);
+					float v = m_read->At(index, c + 3);
+					acceleration += a * a;
+					velocity += v * v;
+				}
+				maxAcceleration = std::max(maxAcceleration, acceleration);
+				maxVelocity = std::max(maxVelocity, velocity);
+			}
+
+			auto& extremes = m_workerExtremes[worker];
+			extremes[0] = std::max(extremes[0], maxAcceleration);
+			extremes[1] = std::max(extremes[1], maxVelocity);
+		});
+
+	float maxAcceleration = 0.0f;
+	float maxVelocity = 0.0f;
+	for (const auto& extremes : m_workerExtremes)
+	{
+		maxAcceleration = std::max(maxAcceleration, extremes[0]);
+		maxVelocity = std::max(maxVelocity, extremes[1]);
+	}
+	maxAcceleration = std::sqrt(maxAcceleration);
+	maxVelocity = std::sqrt(maxVelocity);
+
+	float dt = adaptive.maxTimeStep;
+	if (maxAcceleration > 0.0f) dt = std::min(dt, adaptive.accuracy * std::sqrt(adaptive.length / maxAcceleration));
+	if (maxVelocity > 0.0f) dt = std::min(dt, adaptive.accuracy * adaptive.length / maxVelocity);
+	return std::max(dt, adaptive.minTimeStep);
+}
+
+template <typename Pass>
+void CpuSimulation::ForEachChunk(const Pass& pass)
+{
+	m_pool.ParallelFor(PointsCount(), LINEAR_PER_CHUNK, [&](size_t begin, size_t end, size_t worker)
+		{
+			switch (m_massModel)
+			{
+			case MassModel::Unit:
+				pass(std::integral_constant<MassModel, MassModel::Unit>(), begin, end, worker);
+				break;
+			case MassModel::Uniform:
+				pass(std::integral_constant<MassModel, MassModel::Uniform>(), begin, end, worker);
+				break;
+			case MassModel::PerPoint:
+				pass(std::integral_constant<MassModel, MassModel::PerPoint>(), begin, end, worker);
+				break;
+			}
+		});
+}
+
+template <CpuSimulation::MassModel M>
+float CpuSimulation::Acceleration(int component, size_t index) const
+{
+	const std::vector<float>& force = component == 0 ? m_forceX : component == 1 ? m_forceY : m_forceZ;
+
+	if constexpr (M == MassModel::Unit) return force[index];
+	else if constexpr (M == MassModel::Uniform) return force[index] / m_options.parameters.mass;
+	else return force[index] / m_masses[index];
+}
+
+void CpuSimulation::AdvanceEuler(Point* points, Vertex* vertexes)
+{
+	float dt = m_timeStep;
+
+	ForEachChunk([&](auto model, size_t begin, size_t end, size_t)
+		{
+			for (size_t index = begin; index < end; ++index)
+			{
+				Point point;
+				for (int c = 0; c < 3; ++c)
+				{
+					float totalAcceleration = Acceleration<decltype(model)::value>(c, index);
+					point.position[c] = m_read->At(index, c) + m_read->At(index, c + 3) * dt;
+					point.velocity[c] = m_read->At(index, c + 3) + totalAcceleration * dt;
+				}
+				m_write->Set(index, point);
+
+				if (points)
+				{
+					EmitPoint(index, point, points, vertexes);
+				}
+			}
+		});
+
+	std::swap(m_read, m_write);
+}
+
+void CpuSimulation::AdvanceLeapfrog()
+{
+	// Velocities are kept at the half steps: a kick spans from the middle of the last step to the
+	// middle of this one, the first kick is half a step long
+	float dt = m_timeStep;
+	float kick = m_leapfrogStarted ? 0.5f * (m_previousTimeStep + dt) : 0.5f * dt;
+	m_leapfrogStarted = true;
+
+	ForEachChunk([&](auto model, size_t begin, size_t end, size_t)
+		{
+			for (size_t index = begin; index < end; ++index)
+			{
+				for (int c = 0; c < 3; ++c)
+				{
+					float velocity = m_read->At(index, c + 3) + Acceleration<decltype(model)::value>(c, index) * kick;
+					m_write->At(index, c) = m_read->At(index, c) + velocity * dt;
+					m_write->At(index, c + 3) = velocity;
+				}
+			}
+		});
+
+	std::swap(m_read, m_write);
+}
+
+void CpuSimulation::AdvanceVelocityVerlet()
+{
+	float dt = m_timeStep;
+	float halfDt = 0.5f * dt;
+
+	// Half kick and drift into the other buffer
+	ForEachChunk([&](auto model, size_t begin, size_t end, size_t)
+		{
+			for (size_t index = begin; index < end; ++index)
+			{
+				for (int c = 0; c < 3; ++c)
+				{
+					float velocity = m_read->At(index, c + 3) + Acceleration<decltype(model)::value>(c, index) * halfDt;
+					m_write->At(index, c) = m_read->At(index, c) + velocity * dt;
+					m_write->At(index, c + 3) = velocity;
+				}
+			}
+		});
+
+	std::swap(m_read, m_write);
+
+	// Forces at the new positions, kept for the first half kick of the next step
+	EvaluateForces();
+	m_forcesCurrent = true;
+
+	ForEachChunk([&](auto model, size_t begin, size_t end, size_t)
+		{
+			for (size_t index = begin; index < end; ++index)
+			{
+				for (int c = 0; c < 3; ++c)
+				{
+					m_read->At(index, c + 3) += Acceleration<decltype(model)::value>(c, index) * halfDt;
+				}
+			}
+		});
+}
+
+void CpuSimulation::AdvanceRk4()
+{
+	// Stage derivatives are (velocity, acceleration) of the stage state. The step's start state
+	// stays in one buffer, the stage states go to the other one, where the forces are evaluated;
+	// the last pass replaces the last stage with the result there.
+	float dt = m_timeStep;
+	PointBuffer& start = *m_read;
+	PointBuffer& stage = *m_write;
+
+	// Stage 1 from the forces of ComputeForces, on the start state
+	ForEachChunk([&](auto model, size_t begin, size_t end, size_t)
+		{
+			for (size_t index = begin; index < end; ++index)
+			{
+				for (int c = 0; c < 3; ++c)
+				{
+					float velocity = start.At(index, c + 3);
+					float acceleration = Acceleration<decltype(model)::value>(c, index);
+					m_rkSum.At(index, c) = velocity;
+					m_rkSum.At(index, c + 3) = acceleration;
+					stage.At(index, c) = start.At(index, c) + velocity * 0.5f * dt;
+					stage.At(index, c + 3) = start.At(index, c + 3) + acceleration * 0.5f * dt;
+				}
+			}
+		});
+
+	m_read = &stage;
+	m_write = &start;
+
+	// Stages 2 and 3 are weighted 2 and lead to the next stage state at dt / 2 and dt
+	for (float fraction : { 0.5f, 1.0f })
+	{
+		EvaluateForces();
+		ForEachChunk([&](auto model, size_t begin, size_t end, size_t)
+			{
+				for (size_t index = begin; index < end; ++index)
+				{
+					for (int c = 0; c < 3; ++c)
+					{
+						float velocity = stage.At(index, c + 3);
+						float acceleration = Acceleration<decltype(model)::value>(c, index);
+						m_rkSum.At(index, c) += 2.0f * velocity;
+						m_rkSum.At(index, c + 3) += 2.0f * acceleration;
+						stage.At(index, c) = start.At(index, c) + velocity * fraction * dt;
+						stage.At(index, c + 3) = start.At(index, c + 3) + acceleration * fraction * dt;
+					}
+				}
+			});
+	}
+
+	// Stage 4 and the result
+	EvaluateForces();
+	ForEachChunk([&](auto model, size_t begin, size_t end, size_t)
+		{
+			for (size_t index = begin; index < end; ++index)
+			{
+				for (int c = 0; c < 3; ++c)
+				{
+					float velocity = m_rkSum.At(index, c) + stage.At(index, c + 3);
+					float acceleration = m_rkSum.At(index, c + 3) + Acceleration<decltype(model)::value>(c, index);
+					stage.At(index, c) = start.At(index, c) + velocity * dt / 6.0f;
+					stage.At(index, c + 3) = start.At(index, c + 3) + acceleration * dt / 6.0f;
+				}
+			}
+		});
+}
+
+void CpuSimulation::AdvanceBlockSteps()
+{
+	// Sub-step s ends the steps of the levels whose step length divides it: the levels from
+	// finest - (trailing zero bits of s) on. Points are only drifted once some point's step ends,
+	// by all the sub-steps since the last drift.
+	size_t finest = m_options.blockTimeSteps.levels - 1;
+	size_t substeps = size_t(1) << finest;
+	float dt = m_timeStep;
+	float substepLength = dt / static_cast<float>(substeps);
+	++m_blockStats.steps;
+
+	// All points are synchronized and have their forces: pick the levels and open the steps with
+	// a half kick into the other buffer
+	ForEachChunk([&](auto model, size_t begin, size_t end, size_t worker)
+		{
+			LevelCounts& counts = m_workerLevelCounts[worker];
+			for (size_t index = begin; index < end; ++index)
+			{
+				float acceleration[3];
+				float accelerationSquared = 0.0f;
+				float velocitySquared = 0.0f;
+				for (int c = 0; c < 3; ++c)
+				{
+					acceleration[c] = Acceleration<decltype(model)::value>(c, index);
+					accelerationSquared += acceleration[c] * acceleration[c];
+					velocitySquared += m_read->At(index, c + 3) * m_read->At(index, c + 3);
+				}
+
+				size_t level = BlockLevel(accelerationSquared, velocitySquared, 0);
+				m_levels[index] = static_cast<std::uint8_t>(level);
+				++counts.points[level];
+				++counts.started[level];
+
+				float halfStep = 0.5f * dt / static_cast<float>(size_t(1) << level);
+				for (int c = 0; c < 3; ++c)
+				{
+					m_write->At(index, c) = m_read->At(index, c);
+					m_write->At(index, c + 3) = m_read->At(index, c + 3) + acceleration[c] * halfStep;
+				}
+			}
+		});
+
+	std::swap(m_read, m_write);
+	SumLevelCounts();
+
+	size_t pendingSubsteps = 0;
+	for (size_t substep = 1; substep <= substeps; ++substep)
+	{
+		++pendingSubsteps;
+		size_t minLevel = finest - std::countr_zero(substep);
+		size_t active = std::accumulate(m_levelPoints.begin() + minLevel, m_levelPoints.begin() + finest + 1, size_t(0));
+		if (!active) continue;
+
+		float drift = substepLength * static_cast<float>(pendingSubsteps);
+		pendingSubsteps = 0;
+		m_pool.ParallelFor(PointsCount(), LINEAR_PER_CHUNK, [&](size_t begin, size_t end, size_t)
+			{
+				for (size_t index = begin; index < end; ++index)
+				{
+					for (int c = 0; c < 3; ++c)
+					{
+						m_read->At(index, c) += m_read->At(index, c + 3) * drift;
+					}
+				}
+			});
+
+		if (m_options.forceMode == ForceMode::AllPairs && active < PointsCount())
+		{
+			m_active.clear();
+			for (size_t index = 0; index < PointsCount(); ++index)
+			{
+				if (m_levels[index] >= minLevel) m_active.push_back(index);
+			}
+			ComputeActiveForces();
+		}
+		else
+		{
+			EvaluateForces();
+		}
+		m_blockStats.forcePoints += m_options.forceMode == ForceMode::AllPairs ? active : PointsCount();
+		++m_blockStats.substeps;
+
+		// Close the steps that end here and open the next ones, unless the whole step ends
+		bool last = substep == substeps;
+		ForEachChunk([&](auto model, size_t begin, size_t end, size_t worker)
+			{
+				LevelCounts& counts = m_workerLevelCounts[worker];
+				for (size_t index = begin; index < end; ++index)
+				{
+					size_t level = m_levels[index];
+					if (level >= minLevel)
+					{
+						float acceleration[3];
+						float accelerationSquared = 0.0f;
+						float velocitySquared = 0.0f;
+						float halfStep = 0.5f * dt / static_cast<float>(size_t(1) << level);
+						for (int c = 0; c < 3; ++c)
+						{
+							acceleration[c] = Acceleration<decltype(model)::value>(c, index);
+							accelerationSquared += acceleration[c] * acceleration[c];
+							float velocity = m_read->At(index, c + 3) + acceleration[c] * halfStep;
+							m_read->At(index, c + 3) = velocity;
+							velocitySquared += velocity * velocity;
+						}
+
+						if (!last)
+						{
+							level = BlockLevel(accelerationSquared, velocitySquared, minLevel);
+							m_levels[index] = static_cast<std::uint8_t>(level);
+							++counts.started[level];
+
+							halfStep = 0.5f * dt / static_cast<float>(size_t(1) << level);
+							for (int c = 0; c < 3; ++c)
+							{
+								m_read->At(index, c + 3) += acceleration[c] * halfStep;
+							}
+						}
+					}
+					++counts.points[level];
+				}
+			});
+
+		SumLevelCounts();
+	}
+
+	// The last sub-step evaluated every point, at the new positions
+	m_forcesCurrent = true;
+}
+
+size_t CpuSimulation::BlockLevel(float acceleration, float velocity, size_t minLevel) const
+{
+	// The step AdaptiveTimeStep would pick for this point alone, rounded down to a level
+	const BlockTimeSteps& block = m_options.blockTimeSteps;
+	float wanted = FLT_MAX;
+	if (acceleration > 0.0f) wanted = std::min(wanted, block.accuracy * std::sqrt(block.length / std::sqrt(acceleration)));
+	if (velocity > 0.0f) wanted = std::min(wanted, block.accuracy * block.length / std::sqrt(velocity));
+
+	size_t level = minLevel;
+	float step = m_timeStep / static_cast<float>(size_t(1) << level);
+	while (level + 1 < block.levels && step > wanted)
+	{
+		step *= 0.5f;
+		++level;
+	}
+	return level;
+}
+
+void CpuSimulation::ComputeActiveForces()
+{
+	// As ComputeAllPairs, with the i-blocks gathered from the active points
+	if (m_gather)
+	{
+		m_pool.ParallelFor(PointsCount(), LINEAR_PER_CHUNK, [this](size_t begin, size_t end, size_t)
+			{
+				GatherPositions(begin, end);
+			});
+	}
+
+	if (m_options.halfPositions)
+	{
+		m_pool.ParallelFor(PointsCount(), LINEAR_PER_CHUNK, [this](size_t begin, size_t end, size_t)
+			{
+				ConvertHalfPositions(begin, end);
+			});
+	}
+
+	PositionStream positions = CurrentPositions();
+	size_t count = PointsCount();
+	size_t tileJ = m_options.tileJ ? m_options.tileJ : count;
+
+	m_pool.ParallelFor(m_active.size(), m_options.tileI, [&](size_t begin, size_t end, size_t worker)
+		{
+			for (size_t active = begin; active < end; ++active)
+			{
+				PositionStream point = SlicePositions(positions, m_active[active]);
+				m_activeX[active] = *point.x;
+				m_activeY[active] = *point.y;
+				m_activeZ[active] = *point.z;
+				m_activeForceX[active] = m_activeForceY[active] = m_activeForceZ[active] = 0.0f;
+			}
+
+			for (size_t tile = 0; tile < count; tile += tileJ)
+			{
+				if (m_options.halfPositions)
+				{
+					size_t* self = m_workerSelf[worker].data();
+					for (size_t active = begin; active < end; ++active) self[active - begin] = m_active[active] - tile;
+
+					m_halfTile(
+						m_activeX.data() + begin, m_activeY.data() + begin, m_activeZ.data() + begin, end - begin,
+						SlicePositions(HalfPositions(), tile), std::min(tileJ, count - tile), m_pair, self,
+						m_activeForceX.data() + begin, m_activeForceY.data() + begin, m_activeForceZ.data() + begin);
+				}
+				else
+				{
+					m_tile(
+						m_activeX.data() + begin, m_activeY.data() + begin, m_activeZ.data() + begin, end - begin,
+						SlicePositions(positions, tile), std::min(tileJ, count - tile), m_pair,
+						m_activeForceX.data() + begin, m_activeForceY.data() + begin, m_activeForceZ.data() + begin);
+				}
+
+				if (m_sumTiles)
+				{
+					AddTileSums(worker, end - begin,
+						m_activeForceX.data() + begin, m_activeForceY.data() + begin, m_activeForceZ.data() + begin);
+				}
+			}
+
+			if (m_sumTiles)
+			{
+				StoreTileSums(worker, end - begin,
+					m_activeForceX.data() + begin, m_activeForceY.data() + begin, m_activeForceZ.data() + begin);
+			}
+
+			for (size_t active = begin; active < end; ++active)
+			{
+				size_t index = m_active[active];
+				m_forceX[index] = m_activeForceX[active];
+				m_forceY[index] = m_activeForceY[active];
+				m_forceZ[index] = m_activeForceZ[active];
+			}
+		});
+}
+
+void CpuSimulation::SumLevelCounts()
+{
+	m_levelPoints = {};
+	for (LevelCounts& counts : m_workerLevelCounts)
+	{
+		for (size_t level = 0; level < MAX_BLOCK_LEVELS; ++level)
+		{
+			m_levelPoints[level] += counts.points[level];
+			m_blockStats.levelSteps[level] += counts.started[level];
+		}
+		counts = {};
+	}
+}
+
+void CpuSimulation::RunVertex(std::vector<Vertex>& vertexes) const
+{
+	if (vertexes.size() != PointsCount())
+	{
+		throw std::invalid_argument("Vertex count does not match point count");
+	}
+
+	RunVertex(vertexes, 0, PointsCount());
+}
+
+void CpuSimulation::RunVertex(std::vector<Vertex>& vertexes, size_t first, size_t count) const
+{
+	if (first > PointsCount() || count > PointsCount() - first)
+	{
+		throw std::invalid_argument("Vertex range is past the last point");
+	}
+
+	vertexes.resize(count);
+	m_pool.ParallelFor(count, LINEAR_PER_CHUNK, [&](size_t begin, size_t end, size_t)
+		{
+			for (size_t index = begin; index < end; ++index)
+			{
+				ShadeVertex(first + index, vertexes[index]);
+			}
+		});
+}
+
+void CpuSimulation::ReadBackComputeResults(std::vector<Point>& points) const
+{
+	ReadBackComputeResults(points, 0, PointsCount());
+}
+
+void CpuSimulation::ReadBackComputeResults(std::vector<Point>& points, size_t first, size_t count) const
+{
+	if (first > PointsCount() || count > PointsCount() - first)
+	{
+		throw std::invalid_argument("Read back range is past the last point");
+	}
+
+	// After the swap the latest output is the read buffer
+	points.resize(count);
+	if (m_order.empty())
+	{
+		m_pool.ParallelFor(count, LINEAR_PER_CHUNK, [&](size_t begin, size_t end, size_t)
+			{
+				for (size_t index = begin; index < end; ++index)
+				{
+					points[index] = m_read->Get(first + index);
+				}
+			});
+		return;
+	}
+
+	m_pool.ParallelFor(PointsCount(), LINEAR_PER_CHUNK, [&](size_t begin, size_t end, size_t)
+		{
+			for (size_t slot = begin; slot < end; ++slot)
+			{
+				size_t index = m_order[slot] - first; // Wraps around below first
+				if (index < count)
+				{
+					points[index] = m_read->Get(slot);
+				}
+			}
+		});
+}
+
+void CpuSimulation::ReadBackForces(std::vector<float>& forces) const
+{
+	forces.resize(PointsCount() * 3);
+	m_pool.ParallelFor(PointsCount(), LINEAR_PER_CHUNK, [&](size_t begin, size_t end, size_t)
+		{
+			for (size_t slot = begin; slot < end; ++slot)
+			{
+				size_t index = m_order.empty() ? slot : m_order[slot];
+				forces[index * 3 + 0] = m_forceX[slot];
+				forces[index * 3 + 1] = m_forceY[slot];
+				forces[index * 3 + 2] = m_forceZ[slot];
+			}
+		});
+}
@@ -0,0 +1,393 @@
+﻿#pragma once
+
+#include "CellList.h"
+#include "CpuForceKernels.h"
+#include "Octree.h"
+#include "PointBuffer.h"
+#include "Simulation.h"
+#include "SpaceFillingCurve.h"
+#include "ThreadPool.h"
+#include "VerletList.h"
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
+
+// CPU backend for the CSMain step of ComputeShader.hlsl, for machines without a D3D11 device.
+//
+// Buffers A and B are used the same way as ComputeLoop uses pointsBufferA/pointsBufferB:
+// RunCompute reads the current buffer, writes the other one and swaps them. The buffers use the
+// layout from the options; Point arrays are converted only on construction and read back.
+//
+// Tolerance: every pair is evaluated with the same expressions as CSMain (see CpuForceKernels.h
+// for the one reassociation), so the differences come from rounding: the D3D11 float rules let
+// sqrt and division be off by a few ulp on the GPU, the shader compiler may fuse multiply-adds,
+// and the vector kernels sum the force terms in a different order. After one step the CPU and
+// GPU results agree to within 1e-6 relative error per accumulated force term; for the unit-cube
+// systems created by run() that is below 1e-5 absolute on every component.
+enum class ForceMode
+{
+	AllPairs, // Every point against every other point, like CSMain
+	Symmetric, // Every unordered pair once, equal and opposite force applied to both points
+	CellList,  // Only pairs in neighboring cells of a uniform grid, needs a cutoff
+	Verlet,    // Only pairs in per-point neighbor lists rebuilt when points moved far enough, needs a cutoff
+	Centroid,  // Like AllPairs, but the linear k * d part summed exactly from the centroid, no cutoff
+	BarnesHut  // Centroid, with the rest length part of far octree nodes taken from their centroid
+};
+
+const char* ForceModeName(ForceMode mode);
+
+// Time integration of one step
+enum class Integrator
+{
+	Euler,          // CSMain: positions with the old velocities, velocities with the old forces
+	Leapfrog,       // Kick, then drift: symplectic, velocities are read back half a step ahead
+	VelocityVerlet, // Half kick, drift, forces, half kick: symplectic with synchronized velocities
+	Rk4             // Classic Runge-Kutta, four force evaluations per step; not symplectic, for reference
+};
+
+const char* IntegratorName(Integrator integrator);
+
+// Global time step chosen before every step from the forces of that step:
+//   dt = accuracy * min(sqrt(length / max |a|), length / max |v|)
+// clamped to [minTimeStep, maxTimeStep], so no point moves much more than accuracy * length,
+// or accelerates over that distance, in one step. length is the scale the motion has to resolve,
+// such as the cutoff, the softening or the typical spacing. The integrators stay stable and
+// second order, but with a changing dt leapfrog and velocity Verlet are no longer symplectic.
+struct AdaptiveTimeStep
+{
+	bool enabled = false; // Otherwise every step takes parameters.timeStep
+	float accuracy = 0.2f;
+	float length = 0.01f;
+	float minTimeStep = 1e-4f;
+	float maxTimeStep = 0.1f;
+};
+
+// Most levels of BlockTimeSteps
+const size_t MAX_BLOCK_LEVELS = 16;
+
+// Individual time steps in a hierarchy of levels: a point on level L takes steps of
+// parameters.timeStep / 2^L, picked at the start of each of its steps with the criterion of
+// AdaptiveTimeStep on its own acceleration and velocity. A step may only move to a coarser level
+// where that level's steps start, so the levels stay nested and all points are synchronized at
+// the end of every RunCompute. On every sub-step all points drift, but only the points whose
+// step ends get new forces and kicks, which saves most of the force evaluations when only a
+// few points need short steps. Kick, drift, kick as in Integrator::VelocityVerlet.
+struct BlockTimeSteps
+{
+	bool enabled = false;
+	size_t levels = 6; // 1 to MAX_BLOCK_LEVELS, the finest step is parameters.timeStep / 2^(levels - 1)
+	float accuracy = 0.2f;
+	float length = 0.01f;
+};
+
+struct BlockTimeStepStats
+{
+	size_t steps = 0;          // RunCompute calls
+	size_t substeps = 0;       // Sub-steps on which some point's step ended
+	size_t forcePoints = 0;    // Points that got new forces, a full evaluation counts PointsCount()
+	std::array<size_t, MAX_BLOCK_LEVELS> levelSteps = {}; // Steps started on every level
+};
+
+struct CpuSimulationOptions
+{
+	const ForceKernel* kernel = nullptr; // nullptr picks BestForceKernel()
+	SimulationParameters parameters;
+
+	// Pair force law, compiled into the kernels; the modes that split the spring into a linear and
+	// a rest length part (Centroid, BarnesHut) only support ForceLaw::Spring
+	ForceLaw forceLaw = ForceLaw::Spring;
+	ForceLawParameters law;
+
+	PointLayout layout = PointLayout::Soa;
+
+	// Precision of the force sums: the kernels sum every call as chosen, and with anything but
+	// Float the sums over the j tiles are kept in double. ForceMode::Symmetric only has Float.
+	ForceAccumulation accumulation = ForceAccumulation::Float;
+
+	// ForceMode::AllPairs: the other points are streamed as half floats converted once per force
+	// evaluation. Halves the bytes per pair; positions keep about 3 decimal digits (HalfFloat.h),
+	// which costs about 1e-3 relative error per pair in the unit cube. Points and integration
+	// stay in float.
+	bool halfPositions = false;
+
+	// Storage order: points are sorted along the curve on construction and again every
+	// reorderInterval steps (0 for only once), so points close in space are close in memory.
+	// Read back points and forces stay in the original order.
+	CurveOrder order = CurveOrder::None;
+	size_t reorderInterval = 100;
+	ForceMode forceMode = ForceMode::AllPairs;
+	Integrator integrator = Integrator::Euler;
+	AdaptiveTimeStep adaptiveTimeStep;
+
+	// Needs Integrator::VelocityVerlet and no adaptiveTimeStep. Only ForceMode::AllPairs evaluates
+	// the forces of just the points whose step ends; the other modes evaluate all of them.
+	BlockTimeSteps blockTimeSteps;
+
+	// Pairs at this distance or farther apart produce no force, in every force mode; 0 for none
+	float cutoff = 0.0f;
+
+	// ForceMode::Verlet: the lists hold pairs closer than cutoff + skin and are rebuilt once a
+	// point has moved more than skin / 2. A wider skin means longer lists and fewer rebuilds.
+	float skin = 0.01f;
+
+	// ForceMode::Symmetric: visit the block pairs in rounds in which every block appears once,
+	// so every pair adds its forces straight to the points, in the same order on any number of
+	// threads, instead of to per-worker accumulators. Results are then bitwise identical for any
+	// thread count, as they always are in the other force modes. The cost is a wait for the
+	// slowest pair of every round, about one round per block of 256 points.
+	bool deterministic = false;
+
+	// ForceMode::BarnesHut opening angle: a node is taken as one point at its centroid when its
+	// size is below theta times its distance from the leaf being evaluated; 0 is exact
+	float theta = 0.5f;
+
+	// ForceMode::AllPairs cache blocking: every task takes tileI points and sweeps the other
+	// points in tiles of tileJ, so a tile of positions stays in L1 for the whole i-block.
+	// Both are rounded up to a multiple of 16; tileJ == 0 streams all points at once.
+	size_t tileI = 64;
+	size_t tileJ = 2048;
+};
+
+class CpuSimulation
+{
+public:
+	// masses is either empty, for points of mass options.parameters.mass, or one mass per point.
+	// Uniform and unit mass and r0 == 0 run specialized code paths.
+	CpuSimulation(ThreadPool& pool, const std::vector<Point>& points, const CpuSimulationOptions& options = {},
+		const std::vector<float>& masses = {});
+
+	// Equivalent of RunComputeShader: one step from the current buffer into the other one. With
+	// Integrator::Euler the step is the one of CSMain.
+	void RunCompute();
+
+	// steps steps back to back, with the pool's workers kept awake from the first to the last
+	// (ThreadPool::KeepAwake) instead of being woken for every parallel loop
+	void RunCompute(size_t steps);
+
+	// The two halves of RunCompute, for callers that schedule them separately: the forces on
+	// the current buffer, then the integration into the other buffer and the swap. Every
+	// integrator needs one force evaluation per step there, except for the first velocity Verlet
+	// step and the one after a reorder; Advance evaluates the end-of-step forces of velocity
+	// Verlet, the three other stages of RK4, and all sub-steps of BlockTimeSteps.
+	void ComputeForces();
+	void Advance();
+
+	// RunCompute, ReadBackComputeResults and RunVertex in one pass over the points: with
+	// Integrator::Euler every new point is stored, read back and turned into its vertex while it
+	// is still in registers, instead of being written by the step and read again by the other
+	// two. The other integrators and BlockTimeSteps step as usual and then read back and emit the
+	// vertexes in one pass. AdvanceFused is the fused counterpart of Advance. Like
+	// RunVertex(vertexes), both take outputs of PointsCount() elements and throw
+	// std::invalid_argument otherwise.
+	void RunComputeFused(std::vector<Point>& points, std::vector<Vertex>& vertexes);
+	void AdvanceFused(std::vector<Point>& points, std::vector<Vertex>& vertexes);
+
+	// Equivalent of RunVertexShader (VSMain + GSMain) on the latest step's output
+	void RunVertex(std::vector<Vertex>& vertexes) const;
+
+	void ReadBackComputeResults(std::vector<Point>& points) const;
+
+	// The same for the points [first, first + count) only, resizing the vectors to count. After
+	// a reorder the points of the range are picked from a scan of the storage order.
+	void RunVertex(std::vector<Vertex>& vertexes, size_t first, size_t count) const;
+	void ReadBackComputeResults(std::vector<Point>& points, size_t first, size_t count) const;
+
+	// Total force on every point from the latest force evaluation, x, y and z of every point
+	void ReadBackForces(std::vector<float>& forces) const;
+
+	size_t PointsCount() const { return m_bufferA.Count(); }
+	bool HasPointMasses() const { return !m_masses.empty(); }
+
+	// dt of the latest step, parameters.timeStep before the first one; and the simulated time
+	float TimeStep() const { return m_timeStep; }
+	double Time() const { return m_time; }
+	const ForceKernel& Kernel() const { return *m_options.kernel; }
+
+	// As passed to the constructor, with the kernel and tile sizes resolved
+	const CpuSimulationOptions& Options() const { return m_options; }
+
+	// Rebuild statistics of ForceMode::Verlet, nullptr in the other modes
+	const VerletListStats* VerletStats() const { return m_verlet ? &m_verlet->Stats() : nullptr; }
+
+	// Statistics of BlockTimeSteps, nullptr without them
+	const BlockTimeStepStats* BlockStats() const { return m_options.blockTimeSteps.enabled ? &m_blockStats : nullptr; }
+
+private:
+	// How the integrators turn forces into accelerations
+	enum class MassModel
+	{
+		Unit,     // Every point has mass 1: no division
+		Uniform,  // Every point has options.parameters.mass
+		PerPoint  // m_masses
+	};
+
+	// BlockTimeSteps: points on every level, and steps started on every level since the last sum
+	struct LevelCounts
+	{
+		std::array<size_t, MAX_BLOCK_LEVELS> points = {};
+		std::array<size_t, MAX_BLOCK_LEVELS> started = {};
+	};
+
+	void Reorder();
+	void EvaluateForces();
+	void GatherPositions(size_t begin, size_t end);
+	void ConvertHalfPositions(size_t begin, size_t end);
+	PositionStream CurrentPositions() const;
+	HalfPositionStream HalfPositions() const;
+
+	// Forces on [begin, end) from all points, with the half kernel when halfTileFunction is set
+	void ComputeAllPairs(size_t begin, size_t end, size_t worker, ForceTileFunction tileFunction,
+		ForceHalfTileFunction halfTileFunction = nullptr);
+
+	// Adds the forces of one j tile to the double sums of the worker's i-block and clears them;
+	// StoreTileSums writes the total back
+	void AddTileSums(size_t worker, size_t count, float* fx, float* fy, float* fz);
+	void StoreTileSums(size_t worker, size_t count, float* fx, float* fy, float* fz);
+	void SumPositions();
+	void AddLinearTerm(size_t begin, size_t end);
+	void ComputeSymmetric();
+	void ComputeCellList();
+	void ComputeVerlet();
+	void ComputeBarnesHut();
+
+	// Runs pass(model, begin, end, worker) on chunks of all points, where model is an
+	// std::integral_constant of m_massModel, so the mass handling is compiled into the pass
+	template <typename Pass>
+	void ForEachChunk(const Pass& pass);
+
+	template <MassModel M>
+	float Acceleration(int component, size_t index) const;
+
+	float ChooseTimeStep();
+
+	// Advance, also reading back every point and emitting its vertex unless points is nullptr
+	void AdvanceAndEmit(Point* points, Vertex* vertexes);
+
+	// Read back the point in slot and emit its vertex, in the original order
+	void EmitPoint(size_t slot, const Point& point, Point* points, Vertex* vertexes) const;
+
+	void AdvanceEuler(Point* points, Vertex* vertexes);
+	void AdvanceLeapfrog();
+	void AdvanceVelocityVerlet();
+	void AdvanceRk4();
+	void AdvanceBlockSteps();
+
+	// BlockTimeSteps: level of a point from its squared acceleration and velocity, minLevel or finer
+	size_t BlockLevel(float acceleration, float velocity, size_t minLevel) const;
+
+	// BlockTimeSteps: forces on the points of m_active only
+	void ComputeActiveForces();
+
+	// BlockTimeSteps: m_workerLevelCounts into m_levelPoints and the statistics, then cleared
+	void SumLevelCounts();
+
+	ThreadPool& m_pool;
+	CpuSimulationOptions m_options;
+	PairParameters m_pair; // Force law and cutoff for the kernels, FLT_MAX without a cutoff
+	MassModel m_massModel;
+
+	// Kernel entries for the force law and accumulation, the linear spring ones when r0 == 0
+	ForceTileFunction m_tile;
+	ForceHalfTileFunction m_halfTile;
+	ForceSymmetricTileFunction m_symmetricTile;
+	ForceTileFunction m_restLengthTile;
+
+	PointBuffer m_bufferA;
+	PointBuffer m_bufferB;
+	PointBuffer* m_read = &m_bufferA;
+	PointBuffer* m_write = &m_bufferB;
+
+	// Original index of the point in every storage slot, empty when the order is CurveOrder::None
+	std::vector<size_t> m_order;
+	std::vector<size_t> m_reorderSlots;
+	std::vector<std::uint64_t> m_curveKeys;
+
+	// Integrator::VelocityVerlet: the forces were evaluated at the end of the last step, on the
+	// read buffer as it is; Integrator::Leapfrog: the velocities are half a step ahead
+	bool m_forcesCurrent = false;
+	bool m_leapfrogStarted = false;
+
+	float m_timeStep = 0.0f;
+	float m_previousTimeStep = 0.0f;
+	double m_time = 0.0;
+
+	// AdaptiveTimeStep: per-worker largest squared acceleration and velocity
+	std::vector<std::array<float, 2>> m_workerExtremes;
+
+	// BlockTimeSteps: level of the point in every storage slot and points on every level, the
+	// slots of the points whose step ends on the current sub-step, their positions and forces
+	std::vector<std::uint8_t> m_levels;
+	std::array<size_t, MAX_BLOCK_LEVELS> m_levelPoints = {};
+	std::vector<size_t> m_active;
+	std::vector<float> m_activeX;
+	std::vector<float> m_activeY;
+	std::vector<float> m_activeZ;
+	std::vector<float> m_activeForceX;
+	std::vector<float> m_activeForceY;
+	std::vector<float> m_activeForceZ;
+	std::vector<LevelCounts> m_workerLevelCounts;
+	BlockTimeStepStats m_blockStats;
+
+	// Integrator::Rk4: weighted sum of the stage derivatives of positions and velocities
+	PointBuffer m_rkSum;
+
+	// Mass of the point in every storage slot, empty for MassModel::Unit and MassModel::Uniform
+	std::vector<float> m_masses;
+	size_t m_stepsSinceReorder = 0;
+
+	// Positions of the read buffer as separate arrays, for the layouts the force mode cannot stream
+	bool m_gather = false;
+	std::vector<float> m_x;
+	std::vector<float> m_y;
+	std::vector<float> m_z;
+
+	// halfPositions: positions of the read buffer as half floats
+	std::vector<std::uint16_t> m_halfX;
+	std::vector<std::uint16_t> m_halfY;
+	std::vector<std::uint16_t> m_halfZ;
+
+	// halfPositions: per-worker index in the j tile of every point of an i-block, for the half
+	// kernels to skip the pair of a point with itself
+	std::vector<std::vector<size_t>> m_workerSelf;
+
+	// ForceAccumulation other than Float: per-worker double sums over the j tiles of an
+	// i-block, x, y and z of every point
+	bool m_sumTiles = false;
+	std::vector<std::vector<double>> m_workerTileSums;
+
+	// Total force on every point in the current step
+	std::vector<float> m_forceX;
+	std::vector<float> m_forceY;
+	std::vector<float> m_forceZ;
+
+	// ForceMode::Centroid: sum of all positions in the current step, and the partial sums of
+	// every chunk, added in chunk order so the sum does not depend on the thread count
+	double m_positionSum[3] = {};
+	std::vector<std::array<double, 3>> m_chunkPositionSums;
+
+	// ForceMode::Symmetric: upper triangle of block pairs, and per-worker force accumulators
+	// (x, y and z of every point) summed into m_force* after all pairs are visited. With
+	// options.deterministic the pairs are in rounds starting at m_roundBegin, and the
+	// accumulators are not used.
+	std::vector<std::pair<size_t, size_t>> m_blockPairs;
+	std::vector<size_t> m_roundBegin;
+	std::vector<std::vector<float>> m_workerForces;
+	std::vector<char> m_workerUsed;
+
+	// ForceMode::CellList and ForceMode::BarnesHut: structure rebuilt every step, forces in its
+	// sorted order
+	CellList m_cellList;
+	Octree m_octree;
+	std::vector<std::vector<size_t>> m_workerStacks;
+	std::vector<std::vector<size_t>> m_workerFarNodes;
+	std::vector<float> m_sortedForceX;
+	std::vector<float> m_sortedForceY;
+	std::vector<float> m_sortedForceZ;
+
+	// ForceMode::Verlet: neighbor lists, and per-worker positions of the neighbors of one point
+	std::optional<VerletList> m_verlet;
+	std::vector<std::vector<float>> m_workerNeighbors;
+};
@@ -0,0 +1,56 @@
+﻿#include "HalfFloat.h"
+
+#include <bit>
+
+std::uint16_t FloatToHalf(float value)
+{
+	std::uint32_t bits = std::bit_cast<std::uint32_t>(value);
+	std::uint32_t sign = (bits >> 16) & 0x8000u;
+	std::uint32_t magnitude = bits & 0x7fffffffu;
+
+	// Infinity and NaN, NaN kept quiet
+	if (magnitude >= 0x7f800000u)
+	{
+		return static_cast<std::uint16_t>(sign | 0x7c00u | (magnitude > 0x7f800000u ? 0x200u : 0u));
+	}
+
+	// 65520 and up round beyond the largest half
+	if (magnitude >= 0x477ff000u)
+	{
+		return static_cast<std::uint16_t>(sign | 0x7c00u);
+	}
+
+	// Below 2^-14 the result is denormal, in units of 2^-24; up to 2^-25 it rounds to zero
+	if (magnitude < 0x38800000u)
+	{
+		if (magnitude <= 0x33000000u) return static_cast<std::uint16_t>(sign);
+
+		std::uint32_t mantissa = (magnitude & 0x7fffffu) | 0x800000u;
+		std::uint32_t shift = 126 - (magnitude >> 23);
+		std::uint32_t half = mantissa >> shift;
+		std::uint32_t remainder = mantissa & ((1u << shift) - 1);
+		std::uint32_t halfway = 1u << (shift - 1);
+		if (remainder > halfway || (remainder == halfway && (half & 1))) ++half;
+		return static_cast<std::uint16_t>(sign | half);
+	}
+
+	// Round the 13 dropped mantissa bits, which may carry into the exponent, then rebias it
+	std::uint32_t rounded = magnitude + 0xfffu + ((magnitude >> 13) & 1);
+	return static_cast<std::uint16_t>(sign | ((rounded - 0x38000000u) >> 13));
+}
+
+float HalfToFloat(std::uint16_t half)
+{
+	std::uint32_t sign = (half & 0x8000u) << 16;
+	std::uint32_t magnitude = half & 0x7fffu;
+
+	if (magnitude >= 0x7c00u)
+	{
+		return std::bit_cast<float>(sign | 0x7f800000u | ((magnitude & 0x3ffu) << 13));
+	}
+
+	// The half bits in float position, scaled by 2^112 to rebias the exponent; this also turns
+	// denormal halves into normal floats
+	float value = std::bit_cast<float>(magnitude << 13) * std::bit_cast<float>(0x77800000u);
+	return std::bit_cast<float>(sign | std::bit_cast<std::uint32_t>(value));
+}
@@ -0,0 +1,15 @@
+﻿#pragma once
+
+#include <cstdint>
+
+// IEEE 754 binary16: 1 sign bit, 5 exponent bits, 10 mantissa bits. Values up to 65504, and
+// 11 significant bits, so about 3 decimal digits: positions in the unit cube keep about 2.4e-4.
+//
+// Defined out of line on purpose: the force kernel units are built for different instruction
+// sets and must not share inline functions with the rest of the program.
+
+// Rounded to nearest, ties to even; too large values become infinity
+std::uint16_t FloatToHalf(float value);
+
+// Exact
+float HalfToFloat(std::uint16_t half);
@@ -0,0 +1,165 @@
+﻿#include "Octree.h"
+
+#include "RadixSort.h"
+#include "SpaceFillingCurve.h"
+
+#include <algorithm>
+#include <numeric>
+
+// Points per chunk for the linear passes over all points
+const size_t OCTREE_PER_CHUNK = 16384;
+
+// Bits per axis of the Morton codes, and so the deepest level of the tree
+const int MORTON_BITS = CURVE_BITS;
+
+// Levels built by the calling thread; the subtrees below are built in parallel
+const int OCTREE_TOP_DEPTH = 2;
+
+void Octree::Build(ThreadPool& pool, const PointBuffer& points, size_t leafSize)
+{
+	m_leafSize = std::max<size_t>(1, leafSize);
+	m_nodes.clear();
+	m_leaves.clear();
+
+	size_t count = points.Count();
+	if (!count) return;
+
+	OctreeNode root = {};
+	BoundingCube(pool, points, root.lower, root.size);
+	root.count = count;
+
+	// Points sorted by Morton code
+	ComputeCurveKeys(pool, points, CurveOrder::Morton, root.lower, root.size, m_codes);
+	m_sortedIndex.resize(count);
+	std::iota(m_sortedIndex.begin(), m_sortedIndex.end(), size_t(0));
+	RadixSortByKey(pool, m_codes, m_sortedIndex, 3 * CURVE_BITS);
+
+	m_x.resize(count);
+	m_y.resize(count);
+	m_z.resize(count);
+	pool.ParallelFor(count, OCTREE_PER_CHUNK, [&](size_t begin, size_t end, size_t)
+		{
+			for (size_t sorted = begin; sorted < end; ++sorted)
+			{
+				size_t index = m_sortedIndex[sorted];
+				m_x[sorted] = points.At(index, 0);
+				m_y[sorted] = points.At(index, 1);
+				m_z[sorted] = points.At(index, 2);
+			}
+		});
+
+	// Top levels here, the subtrees below them in parallel, then spliced behind the top levels
+	m_nodes.push_back(root);
+	std::vector<size_t> pending;
+	Split(m_nodes, 0, OCTREE_TOP_DEPTH, &pending);
+
+	std::vector<std::vector<OctreeNode>> subtrees(pending.size());
+	pool.ParallelFor(pending.size(), 1, [&](size_t begin, size_t end, size_t)
+		{
+			for (size_t subtree = begin; subtree < end; ++subtree)
+			{
+				subtrees[subtree].push_back(m_nodes[pending[subtree]]);
+				Split(subtrees[subtree], 0, -1, nullptr);
+			}
+		});
+
+	for (size_t subtree = 0; subtree < pending.size(); ++subtree)
+	{
+		// Local node 0 is the pending node itself, local node k lands at base + k - 1
+		size_t base = m_nodes.size();
+		const auto& nodes = subtrees[subtree];
+		m_nodes[pending[subtree]].child = nodes[0].child + base - 1;
+		m_nodes[pending[subtree]].childCount = nodes[0].childCount;
+		for (size_t node = 1; node < nodes.size(); ++node)
+		{
+			m_nodes.push_back(nodes[node]);
+			if (nodes[node].childCount) m_nodes.back().child += base - 1;
+		}
+	}
+
+	for (size_t node = 0; node < m_nodes.size(); ++node)
+	{
+		if (!m_nodes[node].childCount) m_leaves.push_back(node);
+	}
+	std::sort(m_leaves.begin(), m_leaves.end(), [this](size_t a, size_t b) { return m_nodes[a].first < m_nodes[b].first; });
+
+	// Centroids: leaves from their points, then every parent from its children
+	pool.ParallelFor(m_leaves.size(), 64, [&](size_t begin, size_t end, size_t)
+		{
+			for (size_t leaf = begin; leaf < end; ++leaf)
+			{
+				OctreeNode& node = m_nodes[m_leaves[leaf]];
+				double sum[3] = {};
+				for (size_t sorted = node.first; sorted < node.first + node.count; ++sorted)
+				{
+					sum[0] += m_x[sorted];
+					sum[1] += m_y[sorted];
+					sum[2] += m_z[sorted];
+				}
+				for (int c = 0; c < 3; ++c) node.centroid[c] = static_cast<float>(sum[c] / node.count);
+			}
+		});
+
+	for (size_t node = m_nodes.size(); node-- > 0; )
+	{
+		OctreeNode& parent = m_nodes[node];
+		if (!parent.childCount) continue;
+
+		double sum[3] = {};
+		for (size_t child = parent.child; child < parent.child + parent.childCount; ++child)
+		{
+			for (int c = 0; c < 3; ++c) sum[c] += static_cast<double>(m_nodes[child].centroid[c]) * m_nodes[child].count;
+		}
+		for (int c = 0; c < 3; ++c) parent.centroid[c] = static_cast<float>(sum[c] / parent.count);
+	}
+}
+
+void Octree::Split(std::vector<OctreeNode>& nodes, size_t node, int stopDepth, std::vector<size_t>* pending) const
+{
+	OctreeNode parent = nodes[node];
+	if (parent.count <= m_leafSize || parent.depth == MORTON_BITS) return;
+	if (parent.depth == stopDepth)
+	{
+		pending->push_back(node);
+		return;
+	}
+
+	// Codes are sorted, so the octants at this depth split the range into consecutive runs
+	int shift = 3 * (MORTON_BITS - 1 - parent.depth);
+	float half = 0.5f * parent.size;
+	size_t child = nodes.size();
+	size_t begin = parent.first;
+	size_t end = parent.first + parent.count;
+	for (std::uint64_t octant = 0; octant < 8 && begin < end; ++octant)
+	{
+		size_t last = std::partition_point(m_codes.begin() + begin, m_codes.begin() + end,
+			[&](std::uint64_t code) { return (code >> shift & 7) <= octant; }) - m_codes.begin();
+		if (last == begin) continue;
+
+		OctreeNode octantNode = {};
+		for (int c = 0; c < 3; ++c)
+		{
+			octantNode.lower[c] = parent.lower[c] + ((octant >> c & 1) ? half : 0.0f);
+		}
+		octantNode.size = half;
+		octantNode.first = begin;
+		octantNode.count = last - begin;
+		octantNode.depth = parent.depth + 1;
+		nodes.push_back(octantNode);
+
+		begin = last;
+	}
+
+	size_t childEnd = nodes.size();
+	nodes[node].child = child;
+	nodes[node].childCount = childEnd - child;
+	for (size_t index = child; index < childEnd; ++index)
+	{
+		Split(nodes, index, stopDepth, pending);
+	}
+}
+
+PositionStream Octree::SortedPositions() const
+{
+	return { m_x.data(), m_y.data(), m_z.data(), std::max<size_t>(1, m_x.size()), 0 };
+}
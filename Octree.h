@@ -0,0 +1,55 @@
+﻿#pragma once
+
+#include "CpuForceKernels.h"
+#include "PointBuffer.h"
+#include "ThreadPool.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct OctreeNode
+{
+	float lower[3];    // Corner of the node's cube
+	float size;        // Edge length of the node's cube
+	float centroid[3]; // Mean position of the points below the node
+	size_t first;      // Points below the node are [first, first + count) in sorted order
+	size_t count;
+	size_t child;      // Children are nodes [child, child + childCount), none for a leaf
+	size_t childCount;
+	int depth;
+};
+
+// Octree over the points for Barnes-Hut: points are sorted by Morton code, so every node covers
+// a contiguous range of sorted points and its children split that range by octant. Nodes with
+// at most leafSize points are leaves. Node 0 is the root; children always follow their parent.
+class Octree
+{
+public:
+	void Build(ThreadPool& pool, const PointBuffer& points, size_t leafSize);
+
+	const std::vector<OctreeNode>& Nodes() const { return m_nodes; }
+
+	// Indices of the leaf nodes, in sorted point order
+	const std::vector<size_t>& Leaves() const { return m_leaves; }
+
+	// Original index of the point at a sorted position
+	size_t SortedIndex(size_t sorted) const { return m_sortedIndex[sorted]; }
+
+	// Positions in sorted order as one structure-of-arrays block
+	PositionStream SortedPositions() const;
+
+private:
+	void Split(std::vector<OctreeNode>& nodes, size_t node, int stopDepth, std::vector<size_t>* pending) const;
+
+	size_t m_leafSize = 1;
+
+	std::vector<std::uint64_t> m_codes;
+	std::vector<size_t> m_sortedIndex;
+	std::vector<float> m_x;
+	std::vector<float> m_y;
+	std::vector<float> m_z;
+
+	std::vector<OctreeNode> m_nodes;
+	std::vector<size_t> m_leaves;
+};
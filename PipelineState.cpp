@@ -0,0 +1,164 @@
+﻿#include "PipelineState.h"
+
+#include <stdexcept>
+
+namespace
+{
+	void CheckSlot(size_t slot)
+	{
+		if (slot >= PIPELINE_SLOTS)
+		{
+			throw std::invalid_argument("Pipeline slot out of range");
+		}
+	}
+}
+
+void PipelineState::SetShader(ShaderStage stage, GpuShader shader)
+{
+	GpuShader& bound = m_stages[static_cast<size_t>(stage)].shader;
+	if (bound == shader)
+	{
+		++m_skipped;
+		return;
+	}
+
+	m_context.SetShader(stage, shader);
+	++m_calls;
+	bound = shader;
+}
+
+void PipelineState::SetShaderResource(ShaderStage stage, size_t slot, const BoundView& view)
+{
+	CheckSlot(slot);
+	BoundView& bound = m_stages[static_cast<size_t>(stage)].resources[slot];
+	if (bound.view == view.view)
+	{
+		++m_skipped;
+		return;
+	}
+
+	if (view.resource) UnbindOutputs(view.resource);
+	m_context.SetShaderResource(stage, slot, view.view);
+	++m_calls;
+	bound = view;
+}
+
+void PipelineState::SetConstantBuffer(ShaderStage stage, size_t slot, GpuBuffer buffer)
+{
+	CheckSlot(slot);
+	GpuBuffer& bound = m_stages[static_cast<size_t>(stage)].constants[slot];
+	if (bound == buffer)
+	{
+		++m_skipped;
+		return;
+	}
+
+	m_context.SetConstantBuffer(stage, slot, buffer);
+	++m_calls;
+	bound = buffer;
+}
+
+void PipelineState::SetUnorderedAccess(size_t slot, const BoundView& view)
+{
+	CheckSlot(slot);
+	BoundView& bound = m_unorderedAccess[slot];
+	if (bound.view == view.view)
+	{
+		++m_skipped;
+		return;
+	}
+
+	if (view.resource)
+	{
+		UnbindInputs(view.resource);
+		if (m_streamOutput == view.resource)
+		{
+			SetStreamOutput(nullptr);
+		}
+	}
+	m_context.SetUnorderedAccess(slot, view.view);
+	++m_calls;
+	bound = view;
+}
+
+void PipelineState::SetStreamOutput(GpuBuffer buffer)
+{
+	// Never redundant for a target: the rebind resets its offset
+	if (!buffer && !m_streamOutput)
+	{
+		++m_skipped;
+		return;
+	}
+
+	if (buffer && buffer != m_streamOutput)
+	{
+		UnbindInputs(buffer);
+		for (size_t slot = 0; slot < PIPELINE_SLOTS; ++slot)
+		{
+			if (m_unorderedAccess[slot].resource == buffer) SetUnorderedAccess(slot, {});
+		}
+	}
+	m_context.SetStreamOutput(buffer);
+	++m_calls;
+	m_streamOutput = buffer;
+}
+
+void PipelineState::Dispatch(size_t x, size_t y)
+{
+	m_context.Dispatch(x, y);
+	++m_calls;
+}
+
+void PipelineState::Draw(size_t count, size_t start)
+{
+	m_context.Draw(count, start);
+	++m_calls;
+}
+
+void PipelineState::Clear()
+{
+	for (size_t stage = 0; stage < SHADER_STAGE_COUNT; ++stage)
+	{
+		ShaderStage shaderStage = static_cast<ShaderStage>(stage);
+		for (size_t slot = 0; slot < PIPELINE_SLOTS; ++slot)
+		{
+			if (m_stages[stage].resources[slot].view) SetShaderResource(shaderStage, slot, {});
+			if (m_stages[stage].constants[slot]) SetConstantBuffer(shaderStage, slot, nullptr);
+		}
+		if (m_stages[stage].shader) SetShader(shaderStage, nullptr);
+	}
+	for (size_t slot = 0; slot < PIPELINE_SLOTS; ++slot)
+	{
+		if (m_unorderedAccess[slot].view) SetUnorderedAccess(slot, {});
+	}
+	if (m_streamOutput) SetStreamOutput(nullptr);
+}
+
+void PipelineState::ResetCounts()
+{
+	m_calls = 0;
+	m_skipped = 0;
+}
+
+void PipelineState::UnbindInputs(GpuBuffer resource)
+{
+	for (size_t stage = 0; stage < SHADER_STAGE_COUNT; ++stage)
+	{
+		for (size_t slot = 0; slot < PIPELINE_SLOTS; ++slot)
+		{
+			if (m_stages[stage].resources[slot].resource == resource)
+			{
+				SetShaderResource(static_cast<ShaderStage>(stage), slot, {});
+			}
+		}
+	}
+}
+
+void PipelineState::UnbindOutputs(GpuBuffer resource)
+{
+	for (size_t slot = 0; slot < PIPELINE_SLOTS; ++slot)
+	{
+		if (m_unorderedAccess[slot].resource == resource) SetUnorderedAccess(slot, {});
+	}
+	if (m_streamOutput == resource) SetStreamOutput(nullptr);
+}
@@ -0,0 +1,95 @@
+﻿#pragma once
+
+#include "ReadbackRing.h"
+
+#include <array>
+#include <cstddef>
+
+// Opaque shader and view handles, ID3D11*Shader* and ID3D11*View* for the D3D11 context
+using GpuShader = void*;
+using GpuView = void*;
+
+enum class ShaderStage
+{
+	Compute,
+	Vertex
+};
+
+const size_t SHADER_STAGE_COUNT = 2;
+
+// Resource and unordered access view slots tracked per stage
+const size_t PIPELINE_SLOTS = 8;
+
+// The device context calls of a dispatch or draw, so that PipelineState runs against D3D11 on
+// Windows and against any stand-in elsewhere. A null handle unbinds.
+class PipelineContext
+{
+public:
+	virtual ~PipelineContext() = default;
+
+	virtual void SetShader(ShaderStage stage, GpuShader shader) = 0;
+	virtual void SetShaderResource(ShaderStage stage, size_t slot, GpuView view) = 0;
+	virtual void SetConstantBuffer(ShaderStage stage, size_t slot, GpuBuffer buffer) = 0;
+	virtual void SetUnorderedAccess(size_t slot, GpuView view) = 0; // Compute stage
+	virtual void SetStreamOutput(GpuBuffer buffer) = 0;            // One target at offset 0
+
+	virtual void Dispatch(size_t x, size_t y) = 0;
+	virtual void Draw(size_t count, size_t start) = 0;
+};
+
+// A view together with the buffer it views, for the hazard checks
+struct BoundView
+{
+	GpuView view;
+	GpuBuffer resource;
+};
+
+// Bindings of a PipelineContext as last set through this layer: a bind of what is already bound
+// is skipped, and nothing is unbound after use. A buffer is only unbound where a new binding
+// would make it an input and an output at once, which D3D11 does not allow: binding it as a
+// shader resource unbinds it as unordered access view and stream output target, and the other
+// way round. The stream output target is the exception: binding it sets its append offset back
+// to 0, and a draw appends after the last one otherwise, so it is bound again on every call.
+// Assumes that the context starts with nothing bound and that all its bindings are made through
+// this layer.
+class PipelineState
+{
+public:
+	explicit PipelineState(PipelineContext& context) : m_context(context) {}
+
+	void SetShader(ShaderStage stage, GpuShader shader);
+	void SetShaderResource(ShaderStage stage, size_t slot, const BoundView& view);
+	void SetConstantBuffer(ShaderStage stage, size_t slot, GpuBuffer buffer);
+	void SetUnorderedAccess(size_t slot, const BoundView& view);
+	void SetStreamOutput(GpuBuffer buffer);
+
+	void Dispatch(size_t x, size_t y);
+	void Draw(size_t count, size_t start);
+
+	// Unbinds everything still bound, such as before the bound objects are released
+	void Clear();
+
+	// Calls made to the context, and binds skipped as redundant, since the last ResetCounts
+	size_t Calls() const { return m_calls; }
+	size_t Skipped() const { return m_skipped; }
+	void ResetCounts();
+
+private:
+	struct StageBindings
+	{
+		GpuShader shader = nullptr;
+		std::array<BoundView, PIPELINE_SLOTS> resources = {};
+		std::array<GpuBuffer, PIPELINE_SLOTS> constants = {};
+	};
+
+	// Unbinds the resource from every input, or from every output
+	void UnbindInputs(GpuBuffer resource);
+	void UnbindOutputs(GpuBuffer resource);
+
+	PipelineContext& m_context;
+	std::array<StageBindings, SHADER_STAGE_COUNT> m_stages;
+	std::array<BoundView, PIPELINE_SLOTS> m_unorderedAccess = {};
+	GpuBuffer m_streamOutput = nullptr;
+	size_t m_calls = 0;
+	size_t m_skipped = 0;
+};
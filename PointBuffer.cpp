@@ -0,0 +1,64 @@
+﻿#include "PointBuffer.h"
+
+#include <stdexcept>
+
+// Structure-of-arrays columns are padded to this many floats so vector loads stay in one column
+const size_t SOA_PADDING = 16;
+
+const char* PointLayoutName(PointLayout layout)
+{
+	switch (layout)
+	{
+	case PointLayout::Aos: return "aos";
+	case PointLayout::Soa: return "soa";
+	case PointLayout::Aosoa8: return "aosoa8";
+	case PointLayout::Aosoa16: return "aosoa16";
+	}
+	return "unknown";
+}
+
+PointBuffer::PointBuffer(size_t count, PointLayout layout)
+	: m_count(count)
+{
+	switch (layout)
+	{
+	case PointLayout::Aos: m_blockSize = 1; break;
+	case PointLayout::Soa: m_blockSize = (count + SOA_PADDING - 1) / SOA_PADDING * SOA_PADDING; break;
+	case PointLayout::Aosoa8: m_blockSize = 8; break;
+	case PointLayout::Aosoa16: m_blockSize = 16; break;
+	default: throw std::invalid_argument("Unknown point layout");
+	}
+
+	if (m_blockSize == 0) m_blockSize = SOA_PADDING;
+
+	size_t blocks = (count + m_blockSize - 1) / m_blockSize;
+	m_data.assign(blocks * m_blockSize * 6, 0.0f);
+}
+
+PositionStream PointBuffer::Positions() const
+{
+	return { m_data.data(), m_data.data() + m_blockSize, m_data.data() + 2 * m_blockSize, m_blockSize, m_blockSize * 6 };
+}
+
+void PointBuffer::Assign(const std::vector<Point>& points)
+{
+	if (points.size() != m_count)
+	{
+		throw std::invalid_argument("Point count does not match buffer size");
+	}
+
+	for (size_t index = 0; index < m_count; ++index)
+	{
+		Set(index, points[index]);
+	}
+}
+
+void PointBuffer::CopyTo(std::vector<Point>& points) const
+{
+	points.resize(m_count);
+
+	for (size_t index = 0; index < m_count; ++index)
+	{
+		points[index] = Get(index);
+	}
+}
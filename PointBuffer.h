@@ -0,0 +1,72 @@
+﻿#pragma once
+
+#include "CpuForceKernels.h"
+#include "Simulation.h"
+
+#include <cstddef>
+#include <vector>
+
+// Storage of the CPU backend point state
+enum class PointLayout
+{
+	Aos,     // Point records, positions split into separate arrays before every step
+	Soa,     // x[], y[], z[], vx[], vy[], vz[]
+	Aosoa8,  // Blocks of 8 points, each block is x[8] y[8] z[8] vx[8] vy[8] vz[8]
+	Aosoa16  // Same with blocks of 16 points
+};
+
+const char* PointLayoutName(PointLayout layout);
+
+// Point state in blocks of BlockSize() points. A block holds BlockSize() x values, then y, z,
+// vx, vy and vz. Block size 1 is the Point array itself, a single block is structure-of-arrays.
+// The last block is padded; padding lanes are never read as points.
+class PointBuffer
+{
+public:
+	PointBuffer() = default;
+	PointBuffer(size_t count, PointLayout layout);
+
+	size_t Count() const { return m_count; }
+	size_t BlockSize() const { return m_blockSize; }
+
+	// Component 0-2 is position, 3-5 is velocity
+	float& At(size_t index, int component)
+	{
+		return m_data[(index / m_blockSize) * m_blockSize * 6 + component * m_blockSize + index % m_blockSize];
+	}
+	float At(size_t index, int component) const
+	{
+		return m_data[(index / m_blockSize) * m_blockSize * 6 + component * m_blockSize + index % m_blockSize];
+	}
+
+	Point Get(size_t index) const
+	{
+		Point point;
+		for (int c = 0; c < 3; ++c)
+		{
+			point.position[c] = At(index, c);
+			point.velocity[c] = At(index, c + 3);
+		}
+		return point;
+	}
+	void Set(size_t index, const Point& point)
+	{
+		for (int c = 0; c < 3; ++c)
+		{
+			At(index, c) = point.position[c];
+			At(index, c + 3) = point.velocity[c];
+		}
+	}
+
+	// Only positions, as read by the force kernels
+	PositionStream Positions() const;
+
+	// Conversions at the boundary with the Point arrays used by the GPU path
+	void Assign(const std::vector<Point>& points);
+	void CopyTo(std::vector<Point>& points) const;
+
+private:
+	size_t m_count = 0;
+	size_t m_blockSize = 1;
+	std::vector<float> m_data;
+};
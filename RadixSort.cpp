@@ -0,0 +1,82 @@
+﻿#include "RadixSort.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+// Bits sorted per pass
+const int RADIX_BITS = 8;
+const size_t RADIX_BUCKETS = size_t(1) << RADIX_BITS;
+
+// Keys per range with its own histogram
+const size_t RADIX_PER_CHUNK = 65536;
+
+void RadixSortByKey(ThreadPool& pool, std::vector<std::uint64_t>& keys, std::vector<size_t>& values, int keyBits)
+{
+	if (values.size() != keys.size())
+	{
+		throw std::invalid_argument("Radix sort needs one value per key");
+	}
+
+	size_t count = keys.size();
+	size_t chunks = (count + RADIX_PER_CHUNK - 1) / RADIX_PER_CHUNK;
+
+	std::vector<std::uint64_t> sortedKeys(count);
+	std::vector<size_t> sortedValues(count);
+	std::vector<size_t> offsets(chunks * RADIX_BUCKETS);
+
+	for (int shift = 0; shift < keyBits; shift += RADIX_BITS)
+	{
+		// Histogram of every range
+		std::fill(offsets.begin(), offsets.end(), 0);
+		pool.ParallelFor(chunks, 1, [&](size_t begin, size_t end, size_t)
+			{
+				for (size_t chunk = begin; chunk < end; ++chunk)
+				{
+					size_t* histogram = offsets.data() + chunk * RADIX_BUCKETS;
+					size_t last = std::min(count, (chunk + 1) * RADIX_PER_CHUNK);
+					for (size_t index = chunk * RADIX_PER_CHUNK; index < last; ++index)
+					{
+						++histogram[keys[index] >> shift & (RADIX_BUCKETS - 1)];
+					}
+				}
+			});
+
+		// Start of every (digit, range) pair: digits in order, ranges in order within a digit
+		size_t start = 0;
+		bool single = false;
+		for (size_t digit = 0; digit < RADIX_BUCKETS; ++digit)
+		{
+			size_t digitStart = start;
+			for (size_t chunk = 0; chunk < chunks; ++chunk)
+			{
+				size_t& offset = offsets[chunk * RADIX_BUCKETS + digit];
+				size_t chunkCount = offset;
+				offset = start;
+				start += chunkCount;
+			}
+			single = single || start - digitStart == count;
+		}
+
+		// Every key has the same digit: the pass would not move anything
+		if (single) continue;
+
+		pool.ParallelFor(chunks, 1, [&](size_t begin, size_t end, size_t)
+			{
+				for (size_t chunk = begin; chunk < end; ++chunk)
+				{
+					size_t* offset = offsets.data() + chunk * RADIX_BUCKETS;
+					size_t last = std::min(count, (chunk + 1) * RADIX_PER_CHUNK);
+					for (size_t index = chunk * RADIX_PER_CHUNK; index < last; ++index)
+					{
+						size_t target = offset[keys[index] >> shift & (RADIX_BUCKETS - 1)]++;
+						sortedKeys[target] = keys[index];
+						sortedValues[target] = values[index];
+					}
+				}
+			});
+
+		std::swap(keys, sortedKeys);
+		std::swap(values, sortedValues);
+	}
+}
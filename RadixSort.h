@@ -0,0 +1,11 @@
+﻿#pragma once
+
+#include "ThreadPool.h"
+
+#include <cstdint>
+#include <vector>
+
+// Stable least-significant-digit radix sort of keys, moving values along with them. Only the low
+// keyBits bits of the keys are compared. Every worker counts and scatters its own fixed range of
+// the input, so the result does not depend on the thread count.
+void RadixSortByKey(ThreadPool& pool, std::vector<std::uint64_t>& keys, std::vector<size_t>& values, int keyBits = 64);
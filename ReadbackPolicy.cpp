@@ -0,0 +1,45 @@
+﻿#include "ReadbackPolicy.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+const char* ReadbackModeName(ReadbackMode mode)
+{
+	switch (mode)
+	{
+	case ReadbackMode::Interval: return "interval";
+	case ReadbackMode::OnDemand: return "on-demand";
+	case ReadbackMode::End: return "end";
+	}
+	return "unknown";
+}
+
+ReadbackPolicy::ReadbackPolicy(const ReadbackOptions& options, size_t steps, size_t pointCount)
+	: m_options(options)
+	, m_steps(steps)
+{
+	if (m_options.mode == ReadbackMode::Interval && m_options.interval == 0)
+	{
+		throw std::invalid_argument("Readback interval must be positive");
+	}
+	if (pointCount && m_options.first >= pointCount)
+	{
+		throw std::invalid_argument("Readback range starts past the last point");
+	}
+
+	m_options.count = std::min(m_options.count, pointCount - std::min(m_options.first, pointCount));
+}
+
+bool ReadbackPolicy::ReadBack(size_t step)
+{
+	bool requested = m_requested.exchange(false);
+	if (requested || step + 1 == m_steps) return true;
+
+	switch (m_options.mode)
+	{
+	case ReadbackMode::Interval: return (step + 1) % m_options.interval == 0;
+	case ReadbackMode::OnDemand: return false;
+	case ReadbackMode::End: return false;
+	}
+	return false;
+}
@@ -0,0 +1,50 @@
+﻿#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// When the demo loops read their results back
+enum class ReadbackMode
+{
+	Interval, // After every interval-th step
+	OnDemand, // After the next step once a snapshot was requested
+	End       // After the last step only
+};
+
+const char* ReadbackModeName(ReadbackMode mode);
+
+struct ReadbackOptions
+{
+	ReadbackMode mode = ReadbackMode::Interval;
+	size_t interval = 1;
+
+	// Points read back, with their vertexes: [first, first + count), cut off at the point count
+	size_t first = 0;
+	size_t count = SIZE_MAX;
+};
+
+// Picks the steps of a run whose results are read back, so that the simulation runs free in
+// between instead of copying and synchronizing on every step. The last step is always read back.
+class ReadbackPolicy
+{
+public:
+	// Throws std::invalid_argument for an interval of 0 or a range starting past the points
+	ReadbackPolicy(const ReadbackOptions& options, size_t steps, size_t pointCount);
+
+	// The next step decided by ReadBack is read back, in any mode; may be called from any thread
+	void RequestSnapshot() { m_requested = true; }
+
+	// Whether the results of step, counted from 0, are read back; takes a pending request
+	bool ReadBack(size_t step);
+
+	ReadbackMode Mode() const { return m_options.mode; }
+	size_t First() const { return m_options.first; }
+	size_t Count() const { return m_options.count; }
+	bool WholeRange(size_t pointCount) const { return m_options.first == 0 && m_options.count == pointCount; }
+
+private:
+	ReadbackOptions m_options; // count cut off at the point count
+	size_t m_steps;
+	std::atomic<bool> m_requested = false;
+};
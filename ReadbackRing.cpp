@@ -0,0 +1,119 @@
+﻿#include "ReadbackRing.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+ReadbackRing::ReadbackRing(StagingContext& context, const std::vector<GpuBuffer>& sources, size_t slots,
+	const std::vector<BufferRange>& ranges)
+	: m_context(context)
+	, m_ranges(ranges)
+	, m_mapped(sources.size())
+{
+	if (slots == 0)
+	{
+		throw std::invalid_argument("A readback ring needs at least one slot");
+	}
+
+	if (m_ranges.empty())
+	{
+		for (GpuBuffer source : sources)
+		{
+			m_ranges.push_back({ 0, m_context.BufferSize(source) });
+		}
+	}
+	if (m_ranges.size() != sources.size())
+	{
+		throw std::invalid_argument("Readback needs one range per source buffer");
+	}
+	for (size_t index = 0; index < sources.size(); ++index)
+	{
+		if (m_ranges[index].offset + m_ranges[index].size > m_context.BufferSize(sources[index]))
+		{
+			throw std::invalid_argument("Readback range is past the end of its buffer");
+		}
+	}
+
+	m_slots.reserve(slots);
+	for (size_t slot = 0; slot < slots; ++slot)
+	{
+		std::vector<GpuBuffer> buffers;
+		for (size_t index = 0; index < sources.size(); ++index)
+		{
+			buffers.push_back(m_context.CreateStagingBuffer(sources[index], m_ranges[index].size));
+		}
+		m_slots.push_back(std::move(buffers));
+	}
+}
+
+ReadbackRing::~ReadbackRing()
+{
+	for (auto& buffers : m_slots)
+	{
+		for (GpuBuffer buffer : buffers)
+		{
+			m_context.ReleaseBuffer(buffer);
+		}
+	}
+}
+
+void ReadbackRing::Submit(const std::vector<GpuBuffer>& sources)
+{
+	if (sources.size() != m_ranges.size())
+	{
+		throw std::invalid_argument("Readback needs one source buffer per staging buffer");
+	}
+
+	if (Full())
+	{
+		for (GpuBuffer buffer : m_slots[m_oldest])
+		{
+			m_context.Map(buffer, true);
+			m_context.Unmap(buffer);
+		}
+		m_oldest = (m_oldest + 1) % m_slots.size();
+		--m_inFlight;
+	}
+
+	auto& buffers = m_slots[(m_oldest + m_inFlight) % m_slots.size()];
+	for (size_t index = 0; index < sources.size(); ++index)
+	{
+		m_context.CopyBuffer(buffers[index], sources[index], m_ranges[index]);
+	}
+	++m_inFlight;
+	++m_submitted;
+}
+
+bool ReadbackRing::Collect(const std::vector<void*>& destinations, bool wait)
+{
+	if (destinations.size() != m_ranges.size())
+	{
+		throw std::invalid_argument("Readback needs one destination per staging buffer");
+	}
+	if (m_inFlight == 0) return false;
+
+	// All buffers of the frame are mapped before any is copied, so a frame is taken whole or not at all
+	auto& buffers = m_slots[m_oldest];
+	for (size_t index = 0; index < buffers.size(); ++index)
+	{
+		m_mapped[index] = m_context.Map(buffers[index], wait);
+		if (!m_mapped[index])
+		{
+			for (size_t mapped = 0; mapped < index; ++mapped)
+			{
+				m_context.Unmap(buffers[mapped]);
+			}
+			return false;
+		}
+	}
+
+	for (size_t index = 0; index < buffers.size(); ++index)
+	{
+		memcpy(destinations[index], m_mapped[index], m_ranges[index].size);
+		m_context.Unmap(buffers[index]);
+	}
+
+	m_oldest = (m_oldest + 1) % m_slots.size();
+	--m_inFlight;
+	return true;
+}
@@ -0,0 +1,83 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Opaque GPU buffer, an ID3D11Buffer* for the D3D11 context
+using GpuBuffer = void*;
+
+// Bytes [offset, offset + size) of a buffer
+struct BufferRange
+{
+	size_t offset;
+	size_t size;
+};
+
+// The device context calls of a readback, so that ReadbackRing runs against D3D11 on Windows and
+// against any stand-in elsewhere
+class StagingContext
+{
+public:
+	virtual ~StagingContext() = default;
+
+	// CPU-readable buffer of size bytes that ranges of source and buffers like it can be copied
+	// into, kept until ReleaseBuffer
+	virtual GpuBuffer CreateStagingBuffer(GpuBuffer source, size_t size) = 0;
+	virtual void ReleaseBuffer(GpuBuffer buffer) = 0;
+
+	virtual size_t BufferSize(GpuBuffer buffer) = 0;
+
+	// Queues a copy of range of source to the start of staging
+	virtual void CopyBuffer(GpuBuffer staging, GpuBuffer source, const BufferRange& range) = 0;
+
+	// Contents of staging for reading until Unmap. Without wait, nullptr while the GPU has not
+	// finished the copies into it yet.
+	virtual const void* Map(GpuBuffer staging, bool wait) = 0;
+	virtual void Unmap(GpuBuffer staging) = 0;
+};
+
+// Persistent staging buffers for reading results back without stalling the GPU. Every frame copies
+// a set of GPU buffers into the staging buffers of the next free slot; the frames are
+// collected in submission order once the GPU is done with their copies, polled without waiting.
+// With N slots the GPU can be up to N frames ahead of the CPU before Submit has to wait for the
+// oldest one, and nothing is allocated after construction.
+class ReadbackRing
+{
+public:
+	// slots frames in flight at most; a frame reads one buffer shaped like each of sources, such
+	// as the other buffer of a ping-pong pair. ranges holds the part read of every source, or is
+	// empty to read the whole buffers.
+	ReadbackRing(StagingContext& context, const std::vector<GpuBuffer>& sources, size_t slots,
+		const std::vector<BufferRange>& ranges = {});
+	~ReadbackRing();
+
+	ReadbackRing(const ReadbackRing&) = delete;
+	ReadbackRing& operator=(const ReadbackRing&) = delete;
+
+	size_t Slots() const { return m_slots.size(); }
+	size_t InFlight() const { return m_inFlight; }
+	bool Full() const { return m_inFlight == m_slots.size(); }
+
+	// Frames count from 0 in submission order: frames submitted so far, and the number of the
+	// oldest frame in flight, the next one Collect returns
+	uint64_t Submitted() const { return m_submitted; }
+	uint64_t Oldest() const { return m_submitted - m_inFlight; }
+
+	// Queues the copies of a new frame, sources in the order of the constructor's. A full ring
+	// first waits for its oldest frame and drops it; collect before submitting to keep every frame.
+	void Submit(const std::vector<GpuBuffer>& sources);
+
+	// Copies the oldest frame in flight into destinations, one per source, and frees its slot.
+	// Returns false if no frame is in flight, or without wait if its copies are not done yet.
+	bool Collect(const std::vector<void*>& destinations, bool wait);
+
+private:
+	StagingContext& m_context;
+	std::vector<BufferRange> m_ranges; // Part read of every source
+	std::vector<std::vector<GpuBuffer>> m_slots; // Staging buffer per size of every slot
+	std::vector<const void*> m_mapped;           // Contents of the frame being collected
+	size_t m_oldest = 0;                         // Slot of the oldest frame in flight
+	size_t m_inFlight = 0;
+	uint64_t m_submitted = 0;
+};
@@ -0,0 +1,36 @@
+﻿#pragma once
+
+// Layouts shared by the GPU buffers and the CPU backend, must match the HLSL structs
+struct Point
+{
+	float position[3];
+	float velocity[3];
+};
+
+struct Vertex
+{
+	float position[4];
+};
+
+// Simulation parameters, the layout of the Parameters constant buffer of ComputeShader.hlsl.
+// The defaults are the values the shader used to have built in.
+struct SimulationParameters
+{
+	float springK = 0.01f;   // k
+	float mass = 1.0f;       // m, of every point that has no mass of its own
+	float restLength = 0.2f; // r0
+	float timeStep = 0.01f;  // dt
+};
+
+const float MIN_DISTANCE = 0.0001f; // Pairs closer than this produce no force
+
+// CSMain thread groups, must match the constants in ComputeShader.hlsl. Dispatch(x, y, 1) is
+// limited to 65535 groups per dimension: larger systems use rows of COMPUTE_GROUPS_PER_ROW groups
+// and the shader flattens (x, y) back into a point index.
+const size_t COMPUTE_GROUP_SIZE = 64;       // numthreads
+const size_t COMPUTE_GROUPS_PER_ROW = 65535; // groups along x when y > 1
+
+inline float CalcForce(const SimulationParameters& parameters, float r)
+{
+	return parameters.springK * (r - parameters.restLength);
+}
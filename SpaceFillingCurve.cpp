@@ -0,0 +1,143 @@
+﻿#include "SpaceFillingCurve.h"
+
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <stdexcept>
+
+// Points per chunk for the passes over all points
+const size_t CURVE_PER_CHUNK = 16384;
+
+namespace
+{
+	// Spreads the low 21 bits of value to every third bit
+	std::uint64_t SpreadBits(std::uint64_t value)
+	{
+		value &= 0x1fffff;
+		value = (value | value << 32) & 0x1f00000000ffffull;
+		value = (value | value << 16) & 0x1f0000ff0000ffull;
+		value = (value | value << 8) & 0x100f00f00f00f00full;
+		value = (value | value << 4) & 0x10c30c30c30c30c3ull;
+		value = (value | value << 2) & 0x1249249249249249ull;
+		return value;
+	}
+}
+
+const char* CurveOrderName(CurveOrder order)
+{
+	switch (order)
+	{
+	case CurveOrder::None: return "none";
+	case CurveOrder::Morton: return "morton";
+	case CurveOrder::Hilbert: return "hilbert";
+	}
+	return "unknown";
+}
+
+std::uint64_t MortonKey(std::uint32_t x, std::uint32_t y, std::uint32_t z)
+{
+	return SpreadBits(x) | SpreadBits(y) << 1 | SpreadBits(z) << 2;
+}
+
+std::uint64_t HilbertKey(std::uint32_t x, std::uint32_t y, std::uint32_t z)
+{
+	// Skilling, "Programming the Hilbert curve" (2004): coordinates to the transposed key
+	std::uint32_t axes[3] = { x, y, z };
+	const std::uint32_t top = 1u << (CURVE_BITS - 1);
+
+	for (std::uint32_t bit = top; bit > 1; bit >>= 1)
+	{
+		std::uint32_t below = bit - 1;
+		for (int i = 0; i < 3; ++i)
+		{
+			if (axes[i] & bit)
+			{
+				axes[0] ^= below;
+			}
+			else
+			{
+				std::uint32_t swap = (axes[0] ^ axes[i]) & below;
+				axes[0] ^= swap;
+				axes[i] ^= swap;
+			}
+		}
+	}
+
+	// Gray encode
+	axes[1] ^= axes[0];
+	axes[2] ^= axes[1];
+	std::uint32_t flip = 0;
+	for (std::uint32_t bit = top; bit > 1; bit >>= 1)
+	{
+		if (axes[2] & bit) flip ^= bit - 1;
+	}
+	for (auto& axis : axes) axis ^= flip;
+
+	// The first axis holds the most significant bit of every triple
+	return SpreadBits(axes[2]) | SpreadBits(axes[1]) << 1 | SpreadBits(axes[0]) << 2;
+}
+
+void BoundingCube(ThreadPool& pool, const PointBuffer& points, float lower[3], float& size)
+{
+	// Reduced per worker
+	std::vector<std::array<float, 6>> bounds(pool.ThreadCount(), {
+		std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max(),
+		std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest()
+	});
+	pool.ParallelFor(points.Count(), CURVE_PER_CHUNK, [&](size_t begin, size_t end, size_t worker)
+		{
+			auto& box = bounds[worker];
+			for (size_t index = begin; index < end; ++index)
+			{
+				for (int c = 0; c < 3; ++c)
+				{
+					box[c] = std::min(box[c], points.At(index, c));
+					box[c + 3] = std::max(box[c + 3], points.At(index, c));
+				}
+			}
+		});
+
+	size = 0.0f;
+	for (int c = 0; c < 3; ++c)
+	{
+		float upper = std::numeric_limits<float>::lowest();
+		lower[c] = std::numeric_limits<float>::max();
+		for (const auto& box : bounds)
+		{
+			lower[c] = std::min(lower[c], box[c]);
+			upper = std::max(upper, box[c + 3]);
+		}
+		if (!points.Count()) lower[c] = upper = 0.0f;
+		size = std::max(size, upper - lower[c]);
+	}
+	if (!(size > 0.0f)) size = 1.0f;
+}
+
+void ComputeCurveKeys(ThreadPool& pool, const PointBuffer& points, CurveOrder order,
+	const float lower[3], float size, std::vector<std::uint64_t>& keys)
+{
+	if (order == CurveOrder::None)
+	{
+		throw std::invalid_argument("Curve keys need a curve");
+	}
+
+	const double maxCell = static_cast<double>((1u << CURVE_BITS) - 1);
+	double scale = static_cast<double>(1u << CURVE_BITS) / size;
+
+	keys.resize(points.Count());
+	pool.ParallelFor(points.Count(), CURVE_PER_CHUNK, [&](size_t begin, size_t end, size_t)
+		{
+			for (size_t index = begin; index < end; ++index)
+			{
+				std::uint32_t cell[3];
+				for (int c = 0; c < 3; ++c)
+				{
+					double offset = (static_cast<double>(points.At(index, c)) - lower[c]) * scale;
+					cell[c] = static_cast<std::uint32_t>(std::clamp(offset, 0.0, maxCell));
+				}
+				keys[index] = order == CurveOrder::Morton
+					? MortonKey(cell[0], cell[1], cell[2])
+					: HilbertKey(cell[0], cell[1], cell[2]);
+			}
+		});
+}
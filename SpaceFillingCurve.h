@@ -0,0 +1,33 @@
+﻿#pragma once
+
+#include "PointBuffer.h"
+#include "ThreadPool.h"
+
+#include <cstdint>
+#include <vector>
+
+// Bits per axis of the curve keys; keys use the low 3 * CURVE_BITS bits
+const int CURVE_BITS = 21;
+
+enum class CurveOrder
+{
+	None,    // Points stay in the order they were created
+	Morton,  // Z-order: bits of x, y and z interleaved
+	Hilbert  // Hilbert curve: consecutive keys are always neighboring grid cells
+};
+
+const char* CurveOrderName(CurveOrder order);
+
+// Interleaves the low CURVE_BITS bits of x, y and z, x in the lowest bit of every triple
+std::uint64_t MortonKey(std::uint32_t x, std::uint32_t y, std::uint32_t z);
+
+// Distance along the 3D Hilbert curve through the 2^CURVE_BITS cells per axis
+std::uint64_t HilbertKey(std::uint32_t x, std::uint32_t y, std::uint32_t z);
+
+// Smallest axis-aligned cube containing the points: lower corner and edge length, which is 1
+// when all points coincide
+void BoundingCube(ThreadPool& pool, const PointBuffer& points, float lower[3], float& size);
+
+// Curve key of every point on a grid of 2^CURVE_BITS cells per axis spanning the cube
+void ComputeCurveKeys(ThreadPool& pool, const PointBuffer& points, CurveOrder order,
+	const float lower[3], float size, std::vector<std::uint64_t>& keys);
@@ -0,0 +1,100 @@
+﻿#include "TaskGraph.h"
+
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+
+TaskGraph::TaskId TaskGraph::Add(std::function<void()> func)
+{
+	m_tasks.push_back({ std::move(func), {}, 0 });
+	return m_tasks.size() - 1;
+}
+
+void TaskGraph::Precede(TaskId before, TaskId after)
+{
+	if (before >= m_tasks.size() || after >= m_tasks.size())
+	{
+		throw std::invalid_argument("Unknown task");
+	}
+
+	m_tasks[before].successors.push_back(after);
+	++m_tasks[after].predecessors;
+}
+
+void TaskGraph::Run(ThreadPool& pool)
+{
+	size_t count = m_tasks.size();
+
+	// A cycle would leave its tasks waiting forever: check that every task becomes ready
+	std::vector<size_t> waiting(count);
+	std::vector<TaskId> ready;
+	for (TaskId task = 0; task < count; ++task)
+	{
+		waiting[task] = m_tasks[task].predecessors;
+		if (!waiting[task]) ready.push_back(task);
+	}
+	std::vector<TaskId> roots = ready;
+	for (size_t next = 0; next < ready.size(); ++next)
+	{
+		for (TaskId successor : m_tasks[ready[next]].successors)
+		{
+			if (--waiting[successor] == 0) ready.push_back(successor);
+		}
+	}
+	if (ready.size() != count)
+	{
+		throw std::invalid_argument("Task graph has a cycle");
+	}
+
+	auto pending = std::make_unique<std::atomic<size_t>[]>(count);
+	for (TaskId task = 0; task < count; ++task) pending[task] = m_tasks[task].predecessors;
+
+	std::atomic<size_t> finished = 0;
+	std::atomic<bool> failed = false;
+	std::mutex errorMutex;
+	std::exception_ptr error;
+
+	// Runs a task and queues the successors it was the last dependency of
+	std::function<void(TaskId)> runTask = [&](TaskId task)
+		{
+			if (!failed)
+			{
+				try
+				{
+					m_tasks[task].func();
+				}
+				catch (...)
+				{
+					std::lock_guard<std::mutex> lock(errorMutex);
+					if (!error)
+					{
+						error = std::current_exception();
+					}
+					failed = true;
+				}
+			}
+
+			for (TaskId successor : m_tasks[task].successors)
+			{
+				if (--pending[successor] == 0)
+				{
+					pool.Submit([&runTask, successor](size_t) { runTask(successor); });
+				}
+			}
+			++finished;
+		};
+
+	for (TaskId root : roots)
+	{
+		pool.Submit([&runTask, root](size_t) { runTask(root); });
+	}
+	pool.HelpUntil([&] { return finished == count; });
+
+	if (error)
+	{
+		std::rethrow_exception(error);
+	}
+}
@@ -0,0 +1,37 @@
+﻿#pragma once
+
+#include "ThreadPool.h"
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+// Directed acyclic graph of tasks run on a ThreadPool. A task is queued as soon as all tasks it
+// depends on are done, so independent tasks overlap; tasks may run ParallelFor themselves.
+class TaskGraph
+{
+public:
+	using TaskId = size_t;
+
+	TaskId Add(std::function<void()> func);
+
+	// after starts only once before is done
+	void Precede(TaskId before, TaskId after);
+
+	size_t Count() const { return m_tasks.size(); }
+
+	// Runs every task once and blocks until all are done. After a task throws, the tasks not
+	// started yet are skipped and the first exception is rethrown here. Throws
+	// std::invalid_argument if the dependencies have a cycle.
+	void Run(ThreadPool& pool);
+
+private:
+	struct Task
+	{
+		std::function<void()> func;
+		std::vector<TaskId> successors;
+		size_t predecessors = 0;
+	};
+
+	std::vector<Task> m_tasks;
+};
@@ -0,0 +1,244 @@
+﻿#include "ThreadPool.h"
+
+#include <algorithm>
+
+namespace
+{
+	// Pool and worker index of the current thread, for the threads owned by a pool
+	thread_local const ThreadPool* t_pool = nullptr;
+	thread_local size_t t_worker = 0;
+
+	// One ParallelFor call; shared with the tasks that help with it, which may start after it
+	// returned and then only find that no chunks are left
+	struct Loop
+	{
+		const ThreadPool::RangeFunction* func;
+		size_t count;
+		size_t grain;
+		size_t chunks;
+		std::atomic<size_t> next = 0;
+		std::atomic<size_t> finished = 0;
+		std::atomic<bool> failed = false;
+		std::mutex errorMutex;
+		std::exception_ptr error;
+	};
+
+	void RunChunks(Loop& loop, size_t worker)
+	{
+		for (;;)
+		{
+			size_t begin = loop.next.fetch_add(loop.grain);
+			if (begin >= loop.count) return;
+
+			// After a failure the remaining chunks are only counted
+			if (!loop.failed)
+			{
+				try
+				{
+					(*loop.func)(begin, std::min(loop.count, begin + loop.grain), worker);
+				}
+				catch (...)
+				{
+					std::lock_guard<std::mutex> lock(loop.errorMutex);
+					if (!loop.error)
+					{
+						loop.error = std::current_exception();
+					}
+					loop.failed = true;
+				}
+			}
+			++loop.finished;
+		}
+	}
+}
+
+// Sleeping workers are left alone: the first loop wakes them, and they poll from then on
+ThreadPool::KeepAwake::KeepAwake(ThreadPool& pool) : m_pool(pool)
+{
+	++m_pool.m_awake;
+}
+
+ThreadPool::KeepAwake::~KeepAwake()
+{
+	--m_pool.m_awake;
+}
+
+ThreadPool::ThreadPool(size_t threadCount)
+{
+	if (threadCount == 0)
+	{
+		threadCount = std::max<size_t>(1, std::thread::hardware_concurrency());
+	}
+
+	for (size_t worker = 0; worker < threadCount; ++worker)
+	{
+		m_queues.push_back(std::make_unique<WorkerQueue>());
+	}
+
+	m_threads.reserve(threadCount - 1);
+	for (size_t worker = 1; worker < threadCount; ++worker)
+	{
+		m_threads.emplace_back(&ThreadPool::WorkerMain, this, worker);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_work.notify_all();
+
+	for (auto& thread : m_threads)
+	{
+		thread.join();
+	}
+}
+
+void ThreadPool::ParallelFor(size_t count, size_t grain, const RangeFunction& func)
+{
+	if (count == 0) return;
+	grain = std::max<size_t>(1, grain);
+
+	size_t worker = CurrentWorker();
+	size_t chunks = (count - 1) / grain + 1;
+
+	// Not worth waking anybody up
+	if (m_threads.empty() || chunks == 1)
+	{
+		for (size_t begin = 0; begin < count; begin += grain)
+		{
+			func(begin, std::min(count, begin + grain), worker);
+		}
+		return;
+	}
+
+	auto loop = std::make_shared<Loop>();
+	loop->func = &func;
+	loop->count = count;
+	loop->grain = grain;
+	loop->chunks = chunks;
+
+	// One share per other worker that could help; whoever steals one takes chunks until none are left
+	size_t shares = std::min(m_threads.size(), chunks - 1);
+	for (size_t share = 0; share < shares; ++share)
+	{
+		Submit([loop](size_t helper) { RunChunks(*loop, helper); });
+	}
+
+	RunChunks(*loop, worker);
+	HelpUntil([&] { return loop->finished == loop->chunks; });
+
+	if (loop->error)
+	{
+		std::rethrow_exception(loop->error);
+	}
+}
+
+void ThreadPool::Submit(Task task)
+{
+	// Counted before it is visible, so the count never drops below the number of queued tasks
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		++m_queued;
+	}
+
+	{
+		WorkerQueue& queue = *m_queues[CurrentWorker()];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.tasks.push_back(std::move(task));
+	}
+
+	m_work.notify_one();
+	m_progress.notify_all();
+}
+
+void ThreadPool::HelpUntil(const std::function<bool()>& done)
+{
+	size_t worker = CurrentWorker();
+	auto idleSince = std::chrono::steady_clock::now();
+
+	while (!done())
+	{
+		if (TryRunTask(worker))
+		{
+			idleSince = std::chrono::steady_clock::now();
+			continue;
+		}
+		if (KeepPolling(idleSince)) continue;
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_progress.wait(lock, [&] { return m_queued > 0 || done(); });
+	}
+}
+
+bool ThreadPool::KeepPolling(std::chrono::steady_clock::time_point idleSince) const
+{
+	if (m_awake == 0 || std::chrono::steady_clock::now() - idleSince >= KEEP_AWAKE_SPIN) return false;
+
+	std::this_thread::yield();
+	return true;
+}
+
+size_t ThreadPool::CurrentWorker() const
+{
+	return t_pool == this ? t_worker : 0;
+}
+
+bool ThreadPool::TryRunTask(size_t worker)
+{
+	if (m_queued == 0) return false;
+
+	// Own queue newest first, then the oldest task of the next worker that has one
+	Task task;
+	for (size_t offset = 0; offset < m_queues.size() && !task; ++offset)
+	{
+		WorkerQueue& queue = *m_queues[(worker + offset) % m_queues.size()];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.tasks.empty()) continue;
+
+		if (offset == 0)
+		{
+			task = std::move(queue.tasks.back());
+			queue.tasks.pop_back();
+		}
+		else
+		{
+			task = std::move(queue.tasks.front());
+			queue.tasks.pop_front();
+		}
+	}
+	if (!task) return false;
+
+	--m_queued;
+	task(worker);
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+	}
+	m_progress.notify_all();
+	return true;
+}
+
+void ThreadPool::WorkerMain(size_t worker)
+{
+	t_pool = this;
+	t_worker = worker;
+
+	auto idleSince = std::chrono::steady_clock::now();
+	for (;;)
+	{
+		if (TryRunTask(worker))
+		{
+			idleSince = std::chrono::steady_clock::now();
+			continue;
+		}
+		if (KeepPolling(idleSince)) continue;
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_work.wait(lock, [this] { return m_stop || m_queued > 0; });
+		if (m_stop) return;
+		idleSince = std::chrono::steady_clock::now();
+	}
+}
@@ -0,0 +1,98 @@
+﻿#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed-size work-stealing pool of worker threads.
+//
+// Every worker has its own task queue: it runs its newest task first and steals the oldest
+// task of another worker when its own queue is empty. A thread outside the pool takes part as
+// worker 0 while it waits in ParallelFor or HelpUntil; only one such thread may use the pool
+// at a time. Waiting threads run queued tasks, so ParallelFor may be called from a task.
+class ThreadPool
+{
+public:
+	// Called with a [begin, end) chunk of the range and the index of the worker running it
+	using RangeFunction = std::function<void(size_t begin, size_t end, size_t worker)>;
+
+	// Called with the index of the worker running it; must not throw
+	using Task = std::function<void(size_t worker)>;
+
+	static constexpr std::chrono::microseconds KEEP_AWAKE_SPIN{ 100 };
+
+	// While one is alive, a worker that runs out of tasks, and a caller waiting in ParallelFor or
+	// HelpUntil, polls for new tasks for up to KEEP_AWAKE_SPIN before it sleeps. The parallel
+	// loops of a batch of steps, separated by short serial parts, then find the workers awake
+	// instead of waking them once per loop. Costs up to KEEP_AWAKE_SPIN of a core per idle
+	// thread after every task, also when no other loop follows. May nest; must not outlive the
+	// pool.
+	class KeepAwake
+	{
+	public:
+		explicit KeepAwake(ThreadPool& pool);
+		~KeepAwake();
+
+		KeepAwake(const KeepAwake&) = delete;
+		KeepAwake& operator=(const KeepAwake&) = delete;
+
+	private:
+		ThreadPool& m_pool;
+	};
+
+	// threadCount == 0 uses one thread per hardware thread
+	explicit ThreadPool(size_t threadCount = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	size_t ThreadCount() const { return m_threads.size() + 1; }
+
+	// Splits [0, count) into chunks of at most grain items and runs them on all workers: idle
+	// workers steal a share of the loop and then take chunks until none are left. Blocks until
+	// every chunk is done; the first exception thrown by func is rethrown here. A worker runs
+	// one chunk at a time, so func may keep per-worker state indexed by worker.
+	void ParallelFor(size_t count, size_t grain, const RangeFunction& func);
+
+	// Queues a task on the calling worker's queue
+	void Submit(Task task);
+
+	// Runs queued tasks on the calling thread until done returns true. done is checked again
+	// whenever a task finishes.
+	void HelpUntil(const std::function<bool()>& done);
+
+private:
+	struct WorkerQueue
+	{
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	size_t CurrentWorker() const;
+
+	// Whether a thread idle since idleSince keeps polling, see KeepAwake; yields if so
+	bool KeepPolling(std::chrono::steady_clock::time_point idleSince) const;
+	bool TryRunTask(size_t worker);
+	void WorkerMain(size_t worker);
+
+	std::vector<std::thread> m_threads;
+	std::vector<std::unique_ptr<WorkerQueue>> m_queues;
+	std::atomic<size_t> m_queued = 0;
+
+	// m_work wakes idle workers when a task is queued, m_progress wakes HelpUntil when a task ends
+	std::mutex m_mutex;
+	std::condition_variable m_work;
+	std::condition_variable m_progress;
+	bool m_stop = false;
+	std::atomic<size_t> m_awake = 0; // Live KeepAwake scopes
+};
@@ -0,0 +1,153 @@
+﻿#include "VerletList.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+// Cells per chunk when building the lists
+const size_t VERLET_CELLS_PER_CHUNK = 64;
+
+// Points per chunk for the displacement check
+const size_t VERLET_PER_CHUNK = 16384;
+
+VerletList::VerletList(float cutoff, float skin)
+	: m_cutoff(cutoff)
+	, m_skin(skin)
+{
+	if (!(cutoff > 0.0f))
+	{
+		throw std::invalid_argument("Verlet list needs a positive cutoff");
+	}
+	if (!(skin >= 0.0f))
+	{
+		throw std::invalid_argument("Verlet list skin must not be negative");
+	}
+}
+
+bool VerletList::Update(ThreadPool& pool, const PointBuffer& points)
+{
+	++m_stats.steps;
+
+	if (m_index.size() == points.Count() && !Moved(pool, points))
+	{
+		return false;
+	}
+
+	Build(pool, points);
+	++m_stats.rebuilds;
+	return true;
+}
+
+bool VerletList::Moved(ThreadPool& pool, const PointBuffer& points) const
+{
+	float limit = 0.5f * m_skin;
+	std::vector<char> moved(pool.ThreadCount(), 0);
+
+	pool.ParallelFor(points.Count(), VERLET_PER_CHUNK, [&](size_t begin, size_t end, size_t worker)
+		{
+			for (size_t index = begin; index < end && !moved[worker]; ++index)
+			{
+				float r2 = 0.0f;
+				for (int c = 0; c < 3; ++c)
+				{
+					float d = points.At(index, c) - m_buildPositions[index * 3 + c];
+					r2 += d * d;
+				}
+				if (r2 > limit * limit) moved[worker] = 1;
+			}
+		});
+
+	return std::find(moved.begin(), moved.end(), 1) != moved.end();
+}
+
+void VerletList::Build(ThreadPool& pool, const PointBuffer& points)
+{
+	float radius = m_cutoff + m_skin;
+	m_cells.Build(pool, points, radius);
+
+	size_t count = points.Count();
+	PositionStream positions = m_cells.SortedPositions();
+	const auto& dimensions = m_cells.Dimensions();
+
+	// Calls visit(sorted, neighbor) for every listed pair of the points in a cell
+	auto forEachPair = [&](size_t cell, auto&& visit)
+		{
+			size_t first = m_cells.CellBegin(cell);
+			size_t last = m_cells.CellBegin(cell + 1);
+			if (first == last) return;
+
+			size_t x = cell % dimensions[0];
+			size_t y = cell / dimensions[0] % dimensions[1];
+			size_t z = cell / dimensions[0] / dimensions[1];
+			size_t x0 = x > 0 ? x - 1 : x;
+			size_t x1 = x + 1 < dimensions[0] ? x + 1 : x;
+
+			for (size_t sorted = first; sorted < last; ++sorted)
+			{
+				for (size_t nz = z > 0 ? z - 1 : z; nz <= z + 1 && nz < dimensions[2]; ++nz)
+				{
+					for (size_t ny = y > 0 ? y - 1 : y; ny <= y + 1 && ny < dimensions[1]; ++ny)
+					{
+						size_t rowFirst = m_cells.CellBegin(m_cells.Cell(x0, ny, nz));
+						size_t rowLast = m_cells.CellBegin(m_cells.Cell(x1, ny, nz) + 1);
+						for (size_t other = rowFirst; other < rowLast; ++other)
+						{
+							float dx = positions.x[other] - positions.x[sorted];
+							float dy = positions.y[other] - positions.y[sorted];
+							float dz = positions.z[other] - positions.z[sorted];
+							if (other != sorted && dx * dx + dy * dy + dz * dz < radius * radius)
+							{
+								visit(sorted, other);
+							}
+						}
+					}
+				}
+			}
+		};
+
+	// Count, then fill: the lists of a point are written in the same order on every thread count
+	m_start.assign(count + 1, 0);
+	pool.ParallelFor(m_cells.CellCount(), VERLET_CELLS_PER_CHUNK, [&](size_t begin, size_t end, size_t)
+		{
+			for (size_t cell = begin; cell < end; ++cell)
+			{
+				forEachPair(cell, [&](size_t sorted, size_t) { ++m_start[sorted + 1]; });
+			}
+		});
+
+	m_maxNeighbors = 0;
+	for (size_t sorted = 0; sorted < count; ++sorted)
+	{
+		m_maxNeighbors = std::max(m_maxNeighbors, m_start[sorted + 1]);
+		m_start[sorted + 1] += m_start[sorted];
+	}
+
+	m_neighbors.resize(m_start[count]);
+	pool.ParallelFor(m_cells.CellCount(), VERLET_CELLS_PER_CHUNK, [&](size_t begin, size_t end, size_t)
+		{
+			for (size_t cell = begin; cell < end; ++cell)
+			{
+				size_t written = m_start[m_cells.CellBegin(cell)];
+				forEachPair(cell, [&](size_t, size_t other) { m_neighbors[written++] = m_cells.SortedIndex(other); });
+			}
+		});
+
+	// Order and reference positions for the displacement check
+	m_index.resize(count);
+	m_buildPositions.resize(count * 3);
+	pool.ParallelFor(count, VERLET_PER_CHUNK, [&](size_t begin, size_t end, size_t)
+		{
+			for (size_t sorted = begin; sorted < end; ++sorted)
+			{
+				m_index[sorted] = m_cells.SortedIndex(sorted);
+			}
+			for (size_t index = begin; index < end; ++index)
+			{
+				for (int c = 0; c < 3; ++c)
+				{
+					m_buildPositions[index * 3 + c] = points.At(index, c);
+				}
+			}
+		});
+
+	m_stats.neighbors = m_start[count];
+}
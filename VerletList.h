@@ -0,0 +1,65 @@
+﻿#pragma once
+
+#include "CellList.h"
+#include "PointBuffer.h"
+#include "ThreadPool.h"
+
+#include <cstddef>
+#include <vector>
+
+struct VerletListStats
+{
+	size_t steps = 0;     // Update calls
+	size_t rebuilds = 0;  // Update calls that rebuilt the lists
+	size_t neighbors = 0; // Entries in the current lists, every pair counted from both sides
+};
+
+// Verlet neighbor lists: every point lists the points closer than cutoff + skin. As long as no
+// point has moved more than skin / 2 since the lists were built, no pair can have come closer
+// than cutoff without being listed, so the lists stay valid and only need rebuilding after
+// that. Lists are built from a CellList and kept in its sorted order for locality.
+class VerletList
+{
+public:
+	VerletList(float cutoff, float skin);
+
+	// Rebuilds the lists if this is the first call or a point moved more than skin / 2 since the
+	// last rebuild; returns whether it did
+	bool Update(ThreadPool& pool, const PointBuffer& points);
+
+	// Makes the next Update rebuild, for when the points were moved to other indices
+	void Invalidate() { m_index.clear(); }
+
+	size_t Count() const { return m_index.size(); }
+
+	// Original index of the point at a sorted position
+	size_t Index(size_t sorted) const { return m_index[sorted]; }
+
+	// Original indices of the neighbors of the point at a sorted position:
+	// [Neighbors() + NeighborBegin(sorted), Neighbors() + NeighborBegin(sorted + 1))
+	size_t NeighborBegin(size_t sorted) const { return m_start[sorted]; }
+	const size_t* Neighbors() const { return m_neighbors.data(); }
+
+	// Longest list, for sizing scratch buffers
+	size_t MaxNeighbors() const { return m_maxNeighbors; }
+
+	const VerletListStats& Stats() const { return m_stats; }
+
+private:
+	bool Moved(ThreadPool& pool, const PointBuffer& points) const;
+	void Build(ThreadPool& pool, const PointBuffer& points);
+
+	float m_cutoff;
+	float m_skin;
+
+	CellList m_cells;
+	std::vector<size_t> m_index;
+	std::vector<size_t> m_start;
+	std::vector<size_t> m_neighbors;
+	size_t m_maxNeighbors = 0;
+
+	// Positions at the last rebuild, x, y and z of every point
+	std::vector<float> m_buildPositions;
+
+	VerletListStats m_stats;
+};
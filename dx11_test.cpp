@@ -1,4 +1,5 @@
-﻿#pragma comment(lib, "d3d11.lib")
+﻿#ifdef _WIN32
+#pragma comment(lib, "d3d11.lib")
 #pragma comment(lib, "D3DCompiler.lib")
 #pragma comment(lib, "dxgi.lib")
 
@@ -7,6 +8,7 @@
 #include <d3d11.h>
 #include <d3dcompiler.h>
 #include <dxgi.h>
+#endif
 
 #include <vector>
 #include <iostream>
@@ -15,25 +17,109 @@
 #include <format>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <array>
-
-struct Point
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cfloat>
+#include <climits>
+#include <algorithm>
+#include <optional>
+
+#include "Simulation.h"
+#include "ThreadPool.h"
+#include "TaskGraph.h"
+#include "CpuEnsemble.h"
+#include "CpuSimulation.h"
+#include "PipelineState.h"
+#include "ReadbackPolicy.h"
+#include "ReadbackRing.h"
+
+enum class Backend
 {
-	float position[3];
-	float velocity[3];
+	Gpu, // Direct3D 11 compute/vertex/geometry shaders
+	Cpu  // CpuSimulation on a thread pool
 };
 
-struct Vertex
+struct RunOptions
 {
-	float position[4];
+#ifdef _WIN32
+	Backend backend = Backend::Gpu;
+#else
+	Backend backend = Backend::Cpu;
+#endif
+	size_t points = 10;     // Points in the demo run
+	size_t dumpPoints = 10; // Points printed per iteration, from the first one
+	size_t threads = 0;     // CPU backend worker count, 0 for all hardware threads
+	CpuSimulationOptions cpu; // cpu.parameters are used by both backends
+
+	// GPU backend: iterations in flight between dispatch and readback, see ReadbackRing
+	size_t readbackFrames = 3;
+
+	int iterations = 5; // Iterations of the demo run
+
+	// Steps of every iteration (and of every batch of benchmark steps), submitted back to back:
+	// on the GPU without waiting for the host, on the CPU with the workers woken once. Only the
+	// last step of an iteration is read back and drawn, the readback options count iterations.
+	size_t stepsPerIteration = 1;
+	ReadbackOptions readback;
+	std::vector<size_t> snapshotSteps; // Iterations after which the demo asks for a snapshot, see ReadbackPolicy
+
+	// Per-point masses spread evenly over m * [1 - massSpread, 1 + massSpread], 0 for one mass m
+	float massSpread = 0.0f;
+
+	size_t benchmarkPoints = 0; // Time the CPU backend on this many random points instead of running the demo
+	size_t benchmarkSteps = 10;
+	bool forceError = false; // Compare the forces of the first benchmark step with the all-pairs ones
+
+	// CPU backend: step, read back and emit the vertexes in one pass (CpuSimulation::RunComputeFused)
+	bool fused = false;
+	bool benchmarkOutput = false; // Read back and emit the vertexes of every benchmark step too, implied by fused
+
+	// Time this many independent systems of `points` points each as a CpuEnsemble instead of
+	// running the demo, for benchmarkSteps steps. Their parameters are swept from cpu.parameters to
+	// the ends given here; an end not given is not swept.
+	size_t ensembleSystems = 0;
+	std::optional<float> sweepSpringK;
+	std::optional<float> sweepRestLength;
+	std::optional<float> sweepTimeStep;
 };
 
-const size_t POINTS_COUNT = 10;
+// points and vertexes hold the points from first on
+void DumpIterationResults(const std::vector<Point>& points, const std::vector<Vertex>& vertexes, size_t dumpPoints,
+	size_t first = 0)
+{
+	// Output the results (for debugging)
+	for (size_t idx = 0; idx < std::min(points.size(), dumpPoints); ++idx)
+	{
+		auto& point = points[idx];
 
+		std::cout << std::format(
+			"[{}] Position: ({:.6f}, {:.6f}, {:.6f}); Velocity: ({:.6f}, {:.6f}, {:.6f})",
+			first + idx,
+			point.position[0], point.position[1], point.position[2],
+			point.velocity[0], point.velocity[1], point.velocity[2]
+		) << std::endl;
+
+		auto& vertex = vertexes[idx];
+		std::cout << std::format(
+			"[{}] Vertex: ({:.6f}, {:.6f}, {:.6f}, {:.6f})",
+			first + idx,
+			vertex.position[0], vertex.position[1], vertex.position[2], vertex.position[3]
+		) << std::endl;
+	}
+	std::cout << std::endl;
+}
+
+#ifdef _WIN32
 ID3D11Device* device = nullptr;                  // Direct3D device
 ID3D11DeviceContext* context = nullptr;          // Device context for executing commands
 
 ID3D11ComputeShader* computeShader = nullptr;    // Compute shader
+ID3D11Buffer* parametersBuffer = nullptr;        // Constant buffer with the simulation parameters
+ID3D11Buffer* massesBuffer = nullptr;            // Buffer with the mass of every point, if any
+ID3D11ShaderResourceView* massesSRV = nullptr;   // Resource View for reading the masses
 ID3D11Buffer* pointsBufferA = nullptr;           // Buffer A with point data
 ID3D11Buffer* pointsBufferB = nullptr;           // Buffer B with point data
 ID3D11ShaderResourceView* pointsSRVA = nullptr;  // Resource View A for reading the buffer
@@ -381,6 +467,48 @@ void CreateComputeBuffers(std::vector<Point>& points)
 	ThrowIfFailure(hr, "Failed to create UAV B");
 }
 
+void CreateParameterBuffers(const SimulationParameters& parameters, const std::vector<float>& masses)
+{
+	// Create the constant buffer for the simulation parameters
+	D3D11_BUFFER_DESC bufferDesc = {};
+	bufferDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+	bufferDesc.Usage = D3D11_USAGE_DEFAULT;
+	bufferDesc.ByteWidth = sizeof(SimulationParameters);
+
+	D3D11_SUBRESOURCE_DATA initData = {};
+	initData.pSysMem = &parameters;
+
+	HRESULT hr = device->CreateBuffer(&bufferDesc, &initData, &parametersBuffer);
+	ThrowIfFailure(hr, "Failed to create parameters buffer");
+	DumpBufferDesc("Parameters", parametersBuffer);
+
+	// Without masses the shader uses m for every point
+	if (masses.empty()) return;
+
+	D3D11_BUFFER_DESC massesDesc = {};
+	massesDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+	massesDesc.Usage = D3D11_USAGE_IMMUTABLE;
+	massesDesc.ByteWidth = SafeSizeTToUINT(sizeof(float) * masses.size());
+	massesDesc.StructureByteStride = sizeof(float);
+	massesDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+
+	D3D11_SUBRESOURCE_DATA massesData = {};
+	massesData.pSysMem = masses.data();
+
+	hr = device->CreateBuffer(&massesDesc, &massesData, &massesBuffer);
+	ThrowIfFailure(hr, "Failed to create masses buffer");
+	DumpBufferDesc("Masses", massesBuffer);
+
+	D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	srvDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+	srvDesc.Buffer.FirstElement = 0;
+	srvDesc.Buffer.NumElements = SafeSizeTToUINT(masses.size());
+	srvDesc.Format = DXGI_FORMAT_UNKNOWN;
+
+	hr = device->CreateShaderResourceView(massesBuffer, &srvDesc, &massesSRV);
+	ThrowIfFailure(hr, "Failed to create masses SRV");
+}
+
 void CreateVertexBuffers(std::vector<Vertex>& vertexes)
 {
 	// Create the buffer for the vertex shader output
@@ -398,167 +526,269 @@ void CreateVertexBuffers(std::vector<Vertex>& vertexes)
 	DumpBufferDesc("Vertex Output", vertexOutputBuffer);
 }
 
-void RunComputeShader(ID3D11ShaderResourceView* readSRV, ID3D11UnorderedAccessView* writeUAV)
+// PipelineContext on the immediate context
+class D3D11PipelineContext : public PipelineContext
 {
-	// Set the shader
-	context->CSSetShader(computeShader, nullptr, 0);
-
-	// Set the resources
-	context->CSSetShaderResources(0, 1, &readSRV);
-	context->CSSetUnorderedAccessViews(0, 1, &writeUAV, nullptr);
+public:
+	void SetShader(ShaderStage stage, GpuShader shader) override
+	{
+		if (stage == ShaderStage::Compute)
+		{
+			context->CSSetShader(static_cast<ID3D11ComputeShader*>(shader), nullptr, 0);
+		}
+		else
+		{
+			context->VSSetShader(static_cast<ID3D11VertexShader*>(shader), nullptr, 0);
+		}
+	}
 
-	// Run the shader: for example, POINTS_COUNT points -> POINTS_COUNT dispatches
-	context->Dispatch(POINTS_COUNT, 1, 1);
+	void SetShaderResource(ShaderStage stage, size_t slot, GpuView view) override
+	{
+		ID3D11ShaderResourceView* srv = static_cast<ID3D11ShaderResourceView*>(view);
+		if (stage == ShaderStage::Compute)
+		{
+			context->CSSetShaderResources(SafeSizeTToUINT(slot), 1, &srv);
+		}
+		else
+		{
+			context->VSSetShaderResources(SafeSizeTToUINT(slot), 1, &srv);
+		}
+	}
 
-	// Unset the resources
-	ID3D11UnorderedAccessView* nullUAV = nullptr;
-	ID3D11ShaderResourceView* nullSRV = nullptr;
-	context->CSSetUnorderedAccessViews(0, 1, &nullUAV, nullptr);
-	context->CSSetShaderResources(0, 1, &nullSRV);
-	context->CSSetShader(nullptr, nullptr, 0);
-}
+	void SetConstantBuffer(ShaderStage stage, size_t slot, GpuBuffer buffer) override
+	{
+		ID3D11Buffer* constants = static_cast<ID3D11Buffer*>(buffer);
+		if (stage == ShaderStage::Compute)
+		{
+			context->CSSetConstantBuffers(SafeSizeTToUINT(slot), 1, &constants);
+		}
+		else
+		{
+			context->VSSetConstantBuffers(SafeSizeTToUINT(slot), 1, &constants);
+		}
+	}
 
-void RunVertexShader(ID3D11ShaderResourceView* readSRV)
-{
-	// Set the shader
-	context->VSSetShader(vertexShader, nullptr, 0);
+	void SetUnorderedAccess(size_t slot, GpuView view) override
+	{
+		ID3D11UnorderedAccessView* uav = static_cast<ID3D11UnorderedAccessView*>(view);
+		context->CSSetUnorderedAccessViews(SafeSizeTToUINT(slot), 1, &uav, nullptr);
+	}
 
-	// Set the resources
-	UINT stride = sizeof(Vertex);
-	UINT offset = 0;
-	context->VSSetShaderResources(0, 1, &readSRV);
-	context->SOSetTargets(1, &vertexOutputBuffer, &offset);
+	void SetStreamOutput(GpuBuffer buffer) override
+	{
+		ID3D11Buffer* target = static_cast<ID3D11Buffer*>(buffer);
+		UINT offset = 0;
+		context->SOSetTargets(1, &target, &offset);
+	}
 
-	// Draw call to process the data with the vertex shader
-	context->Draw(POINTS_COUNT, 0);
+	void Dispatch(size_t x, size_t y) override
+	{
+		context->Dispatch(SafeSizeTToUINT(x), SafeSizeTToUINT(y), 1);
+	}
 
-	// Unset the resources
-	ID3D11ShaderResourceView* nullSRV = nullptr;
-	ID3D11Buffer* nullBuffer = nullptr;
-	context->VSSetShaderResources(0, 1, &nullSRV);
-	context->SOSetTargets(1, &nullBuffer, &offset);
-	context->VSSetShader(nullptr, nullptr, 0);
-}
+	void Draw(size_t count, size_t start) override
+	{
+		context->Draw(SafeSizeTToUINT(count), SafeSizeTToUINT(start));
+	}
+};
 
-void ReadBackComputeResults(ID3D11Buffer* buffer, std::vector<Point>& points)
+void DispatchPoints(PipelineState& state, size_t count)
 {
-	DumpBufferDesc("Compute", buffer);
+	// One thread per point; past 65535 groups the groups are laid out in rows, see Simulation.h
+	size_t groups = (count + COMPUTE_GROUP_SIZE - 1) / COMPUTE_GROUP_SIZE;
+	size_t rows = (groups + COMPUTE_GROUPS_PER_ROW - 1) / COMPUTE_GROUPS_PER_ROW;
+	if (rows > D3D11_CS_DISPATCH_MAX_THREAD_GROUPS_PER_DIMENSION)
+	{
+		throw std::out_of_range(std::format("Too many points for one dispatch: {}", count));
+	}
 
-	// Description of the buffer for reading data back to the CPU
-	D3D11_BUFFER_DESC readBackBufferDesc = {};
-	readBackBufferDesc.Usage = D3D11_USAGE_STAGING;
-	readBackBufferDesc.ByteWidth = SafeSizeTToUINT(sizeof(Point) * points.size());
-	readBackBufferDesc.StructureByteStride = sizeof(Point);
-	readBackBufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
-	readBackBufferDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+	size_t columns = rows > 1 ? COMPUTE_GROUPS_PER_ROW : groups;
+	state.Dispatch(columns, rows);
+}
 
-	ID3D11Buffer* readBackBuffer;
-	ThrowIfFailure(
-		device->CreateBuffer(&readBackBufferDesc, nullptr, &readBackBuffer),
-		"Failed to create compute read back buffer"
-	);
+// The shaders leave their bindings in place for the next iteration; PipelineState skips what is
+// already bound and unbinds a point buffer only when it changes between input and output
+void RunComputeShader(PipelineState& state, const BoundView& read, const BoundView& write, size_t count)
+{
+	state.SetShader(ShaderStage::Compute, computeShader);
 
-	// Copy data from the output buffer
-	context->CopyResource(readBackBuffer, buffer);
+	state.SetShaderResource(ShaderStage::Compute, 0, read);
+	state.SetShaderResource(ShaderStage::Compute, 1, { massesSRV, massesBuffer });
+	state.SetUnorderedAccess(0, write);
+	state.SetConstantBuffer(ShaderStage::Compute, 0, parametersBuffer);
 
-	// Map the data for reading
-	D3D11_MAPPED_SUBRESOURCE mappedResource;
-	ThrowIfFailure(
-		context->Map(readBackBuffer, 0, D3D11_MAP_READ, 0, &mappedResource),
-		"Failed to map compute read back buffer"
-	);
+	DispatchPoints(state, count);
+}
 
-	memcpy(points.data(), mappedResource.pData, sizeof(Point) * points.size());
+void RunVertexShader(PipelineState& state, const BoundView& read, size_t count)
+{
+	state.SetShader(ShaderStage::Vertex, vertexShader);
 
-	// Unmap the resource
-	context->Unmap(readBackBuffer, 0);
+	// Bound every time, which starts the output at vertex 0 again; the draws below append to it
+	state.SetShaderResource(ShaderStage::Vertex, 0, read);
+	state.SetStreamOutput(vertexOutputBuffer);
 
-	readBackBuffer->Release();
+	// Draw calls to process the data with the vertex shader; SV_VertexID counts on from the start vertex
+	const size_t maxDraw = UINT_MAX;
+	for (size_t first = 0; first < count; first += maxDraw)
+	{
+		state.Draw(std::min(maxDraw, count - first), first);
+	}
 }
 
-void ReadBackVertexResults(std::vector<Vertex>& vertexes)
+// StagingContext on the device and its immediate context
+class D3D11StagingContext : public StagingContext
 {
-	DumpBufferDesc("Vertex", vertexOutputBuffer);
+public:
+	GpuBuffer CreateStagingBuffer(GpuBuffer source, size_t size) override
+	{
+		// Same stride and structure as the source, for CopySubresourceRegion
+		D3D11_BUFFER_DESC readBackBufferDesc;
+		static_cast<ID3D11Buffer*>(source)->GetDesc(&readBackBufferDesc);
+		readBackBufferDesc.ByteWidth = SafeSizeTToUINT(size);
+		readBackBufferDesc.Usage = D3D11_USAGE_STAGING;
+		readBackBufferDesc.BindFlags = 0;
+		readBackBufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+
+		ID3D11Buffer* readBackBuffer;
+		ThrowIfFailure(
+			device->CreateBuffer(&readBackBufferDesc, nullptr, &readBackBuffer),
+			"Failed to create read back buffer"
+		);
+		DumpBufferDesc("Read back", readBackBuffer);
+		return readBackBuffer;
+	}
 
-	// Create a staging buffer for reading back data
-	D3D11_BUFFER_DESC readBackBufferDesc = {};
-	readBackBufferDesc.Usage = D3D11_USAGE_STAGING;
-	readBackBufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
-	readBackBufferDesc.ByteWidth = SafeSizeTToUINT(sizeof(Vertex) * vertexes.size());
-	readBackBufferDesc.StructureByteStride = sizeof(Vertex);
-	readBackBufferDesc.BindFlags = 0;
-	readBackBufferDesc.MiscFlags = 0;
+	void ReleaseBuffer(GpuBuffer buffer) override
+	{
+		static_cast<ID3D11Buffer*>(buffer)->Release();
+	}
 
-	ID3D11Buffer* readBackBuffer;
-	ThrowIfFailure(
-		device->CreateBuffer(&readBackBufferDesc, nullptr, &readBackBuffer),
-		"Failed to create vertex read back buffer"
-	);
+	size_t BufferSize(GpuBuffer buffer) override
+	{
+		return GetBufferSize<char>(static_cast<ID3D11Buffer*>(buffer));
+	}
 
-	// Copy data from the output buffer
-	context->CopyResource(readBackBuffer, vertexOutputBuffer);
+	void CopyBuffer(GpuBuffer staging, GpuBuffer source, const BufferRange& range) override
+	{
+		// Buffers are one row of bytes
+		D3D11_BOX box = {};
+		box.left = SafeSizeTToUINT(range.offset);
+		box.right = SafeSizeTToUINT(range.offset + range.size);
+		box.bottom = 1;
+		box.back = 1;
+		context->CopySubresourceRegion(static_cast<ID3D11Buffer*>(staging), 0, 0, 0, 0, static_cast<ID3D11Buffer*>(source), 0, &box);
+	}
 
-	// Map the data for reading
-	D3D11_MAPPED_SUBRESOURCE mappedResource;
-	ThrowIfFailure(
-		context->Map(readBackBuffer, 0, D3D11_MAP_READ, 0, &mappedResource),
-		"Failed to map vertex read back buffer"
-	);
-	memcpy(vertexes.data(), mappedResource.pData, sizeof(Vertex) * vertexes.size());
+	const void* Map(GpuBuffer staging, bool wait) override
+	{
+		D3D11_MAPPED_SUBRESOURCE mappedResource;
+		HRESULT hr = context->Map(static_cast<ID3D11Buffer*>(staging), 0, D3D11_MAP_READ,
+			wait ? 0 : D3D11_MAP_FLAG_DO_NOT_WAIT, &mappedResource);
+		if (hr == DXGI_ERROR_WAS_STILL_DRAWING) return nullptr;
 
-	context->Unmap(readBackBuffer, 0);
+		ThrowIfFailure(hr, "Failed to map read back buffer");
+		return mappedResource.pData;
+	}
 
-	readBackBuffer->Release();
-}
+	void Unmap(GpuBuffer staging) override
+	{
+		context->Unmap(static_cast<ID3D11Buffer*>(staging), 0);
+	}
+};
 
-void ComputeLoop(std::vector<Point>& points, std::vector<Vertex>& vertexes, int numIterations)
+void ComputeLoop(std::vector<Point>& points, std::vector<Vertex>& vertexes, int numIterations, size_t stepsPerIteration,
+	size_t dumpPoints, size_t readbackFrames, ReadbackPolicy& policy, const std::vector<size_t>& snapshotSteps)
 {
 	ID3D11Buffer* currentReadBuffer = pointsBufferA;
 	ID3D11Buffer* currentWriteBuffer = pointsBufferB;
-	ID3D11ShaderResourceView* currentReadSRV = pointsSRVA;
-	ID3D11ShaderResourceView* currentWriteSRV = pointsSRVB;
-	ID3D11UnorderedAccessView* currentReadUAV = pointsUAVA;
-	ID3D11UnorderedAccessView* currentWriteUAV = pointsUAVB;
+	BoundView currentReadSRV = { pointsSRVA, pointsBufferA };
+	BoundView currentWriteSRV = { pointsSRVB, pointsBufferB };
+	BoundView currentReadUAV = { pointsUAVA, pointsBufferA };
+	BoundView currentWriteUAV = { pointsUAVB, pointsBufferB };
+
+	D3D11PipelineContext pipelineContext;
+	PipelineState state(pipelineContext);
+	std::vector<size_t> iterationCalls; // Context calls made by the shaders of every iteration
+
+	// Only the range of the policy is copied. Both point buffers have the same shape, either one
+	// will do for the staging buffers.
+	size_t first = policy.First();
+	size_t count = policy.Count();
+	std::vector<Point> readPoints(count);
+	std::vector<Vertex> readVertexes(count);
+
+	D3D11StagingContext staging;
+	ReadbackRing ring(staging, { pointsBufferA, vertexOutputBuffer }, readbackFrames, {
+		{ sizeof(Point) * first, sizeof(Point) * count },
+		{ sizeof(Vertex) * first, sizeof(Vertex) * count }
+	});
+	std::vector<void*> destinations = { readPoints.data(), readVertexes.data() };
+	std::vector<int> frameIterations; // Iteration of every submitted frame
+
+	// Reads back and prints the oldest iteration in flight
+	auto collect = [&](bool wait)
+		{
+			if (!ring.InFlight()) return false;
 
-	for (int i = 0; i < numIterations; ++i)
-	{
-		std::cout << "Iteration " << i << std::endl;
+			int iteration = frameIterations[ring.Oldest()];
+			if (!ring.Collect(destinations, wait)) return false;
 
-		// Run shaders
-		RunComputeShader(currentReadSRV, currentWriteUAV);
-		RunVertexShader(currentWriteSRV);
+			std::cout << "Iteration " << iteration << std::endl;
+			DumpIterationResults(readPoints, readVertexes, dumpPoints, first);
+			return true;
+		};
 
-		// Read back the results
-		ReadBackComputeResults(currentWriteBuffer, points);
-		ReadBackVertexResults(vertexes);
+	for (int i = 0; i < numIterations; ++i)
+	{
+		// Run shaders: the steps ping-pong between the buffers with nothing in between, and the
+		// vertexes are only drawn from the last one, which is in the read buffer after the swap
+		state.ResetCounts();
+		for (size_t step = 0; step < stepsPerIteration; ++step)
+		{
+			RunComputeShader(state, currentReadSRV, currentWriteUAV, points.size());
 
-		// Swap the buffers
-		std::swap(currentReadBuffer, currentWriteBuffer);
-		std::swap(currentReadSRV, currentWriteSRV);
-		std::swap(currentReadUAV, currentWriteUAV);
+			std::swap(currentReadBuffer, currentWriteBuffer);
+			std::swap(currentReadSRV, currentWriteSRV);
+			std::swap(currentReadUAV, currentWriteUAV);
+		}
+		RunVertexShader(state, currentReadSRV, points.size());
+		iterationCalls.push_back(state.Calls());
 
-		// Output the results (for debugging)
-		size_t idx = 0;
-		for (size_t idx = 0; idx < POINTS_COUNT; ++idx)
+		// Queue the read back of the results, if they are wanted. With every slot in flight, wait
+		// for the oldest iteration: it has had the most time to finish.
+		if (std::ranges::find(snapshotSteps, static_cast<size_t>(i)) != snapshotSteps.end())
 		{
-			auto& point = points[idx];
-
-			std::cout << std::format(
-				"[{}] Position: ({:.6f}, {:.6f}, {:.6f}); Velocity: ({:.6f}, {:.6f}, {:.6f})",
-				idx,
-				point.position[0], point.position[1], point.position[2],
-				point.velocity[0], point.velocity[1], point.velocity[2]
-			) << std::endl;
+			policy.RequestSnapshot();
+		}
+		if (policy.ReadBack(i))
+		{
+			if (ring.Full())
+			{
+				collect(true);
+			}
+			frameIterations.push_back(i);
+			ring.Submit({ currentReadBuffer, vertexOutputBuffer });
+		}
 
-			auto& vertex = vertexes[idx];
-			std::cout << std::format(
-				"[{}] Vertex: ({:.6f}, {:.6f}, {:.6f}, {:.6f})",
-				idx,
-				vertex.position[0], vertex.position[1], vertex.position[2], vertex.position[3]
-			) << std::endl;
+		// Print the iterations that are done by now, without waiting for the others
+		while (collect(false))
+		{
 		}
-		std::cout << std::endl;
 	}
+
+	while (collect(true))
+	{
+	}
+	state.Clear();
+
+	std::cout << "Device context calls per iteration:";
+	for (size_t calls : iterationCalls) std::cout << " " << calls;
+	std::cout << std::endl;
+
+	// The last step is always read back
+	points = readPoints;
+	vertexes = readVertexes;
 }
 
 void CleanupMain()
@@ -576,6 +806,9 @@ void CleanupCompute()
 	if (pointsSRVB) pointsSRVB->Release();
 	if (pointsUAVA) pointsUAVA->Release();
 	if (pointsUAVB) pointsUAVB->Release();
+	if (parametersBuffer) parametersBuffer->Release();
+	if (massesBuffer) massesBuffer->Release();
+	if (massesSRV) massesSRV->Release();
 }
 
 void CleanupVertex()
@@ -590,18 +823,171 @@ void Cleanup()
 	CleanupCompute();
 	CleanupMain();
 }
+#endif
 
-void run()
+// One iteration's results, filled by the readback, vertex and statistics tasks of CpuComputeLoop
+struct IterationSnapshot
 {
-	HWND hWnd = nullptr;
+	std::vector<Point> points;
+	std::vector<Vertex> vertexes;
+	double kineticEnergy = 0.0;
+	float timeStep = 0.0f;
+	double time = 0.0;
+};
 
-	// Initialize Direct3D
-	InitD3D(hWnd);
+double KineticEnergy(const std::vector<Point>& points, const SimulationParameters& parameters, const std::vector<float>& masses)
+{
+	double energy = 0.0;
+	for (size_t idx = 0; idx < points.size(); ++idx)
+	{
+		double mass = masses.empty() ? parameters.mass : masses[idx];
+		for (int c = 0; c < 3; ++c)
+		{
+			energy += 0.5 * mass * points[idx].velocity[c] * points[idx].velocity[c];
+		}
+	}
+	return energy;
+}
 
-	// Create initial point data
-	std::vector<Point> points(POINTS_COUNT);
-	std::vector<Vertex> vertexes(POINTS_COUNT);
-	for (size_t idx = 0; idx < POINTS_COUNT; ++idx)
+void CpuComputeLoop(ThreadPool& pool, CpuSimulation& simulation, std::vector<Point>& points, std::vector<Vertex>& vertexes,
+	const std::vector<float>& masses, int numIterations, size_t stepsPerIteration, size_t dumpPoints, bool fused,
+	ReadbackPolicy& policy, const std::vector<size_t>& snapshotSteps)
+{
+	// Every iteration is a graph of tasks: forces, integration, then readback and vertex
+	// generation, statistics and output. The next iteration's forces only wait for the
+	// integration and readback, so they overlap with the statistics and output of this one.
+	// Iterations alternate between two snapshots: the readback and vertex generation of
+	// iteration i + 2 wait for the output of iteration i. The step decides whether its results
+	// are read back at all; the other tasks of an iteration that is not do nothing.
+	size_t first = policy.First();
+	size_t count = policy.Count();
+	bool fusedOutput = fused && policy.WholeRange(simulation.PointsCount());
+	std::vector<float> rangeMasses = masses.empty()
+		? masses
+		: std::vector<float>(masses.begin() + first, masses.begin() + first + count);
+
+	std::array<IterationSnapshot, 2> snapshots;
+	for (auto& snapshot : snapshots)
+	{
+		snapshot.points.resize(count);
+		snapshot.vertexes.resize(count);
+	}
+	std::vector<char> wanted(numIterations);
+
+	TaskGraph graph;
+	std::vector<TaskGraph::TaskId> advances;
+	std::vector<TaskGraph::TaskId> readbacks;
+	std::vector<TaskGraph::TaskId> outputs;
+	for (int i = 0; i < numIterations; ++i)
+	{
+		IterationSnapshot& snapshot = snapshots[i % 2];
+		char& read = wanted[i];
+
+		// Run the CPU equivalents of the shaders; buffers are swapped inside Advance. Fused, the
+		// step itself reads back and emits the vertexes. With more than one step per iteration,
+		// the steps before the last one are not read back and run with the workers kept awake;
+		// the output tasks are left out of that.
+		auto forces = graph.Add([&pool, &simulation, stepsPerIteration]
+			{
+				if (stepsPerIteration == 1)
+				{
+					simulation.ComputeForces();
+					return;
+				}
+
+				ThreadPool::KeepAwake awake(pool);
+				simulation.RunCompute(stepsPerIteration - 1);
+				simulation.ComputeForces();
+			});
+		auto advance = graph.Add([i, &simulation, &snapshot, &read, &policy, &snapshotSteps, fusedOutput]
+			{
+				// Stands in for a viewer that asks for a snapshot now and then
+				if (std::ranges::find(snapshotSteps, static_cast<size_t>(i)) != snapshotSteps.end())
+				{
+					policy.RequestSnapshot();
+				}
+				read = policy.ReadBack(i);
+
+				if (read && fusedOutput) simulation.AdvanceFused(snapshot.points, snapshot.vertexes);
+				else simulation.Advance();
+			});
+
+		// Read back the results
+		auto readback = graph.Add([&simulation, &snapshot, &read, first, count, fusedOutput]
+			{
+				if (!read) return;
+				if (!fusedOutput)
+				{
+					simulation.ReadBackComputeResults(snapshot.points, first, count);
+				}
+				snapshot.timeStep = simulation.TimeStep();
+				snapshot.time = simulation.Time();
+			});
+		auto statistics = graph.Add([&simulation, &snapshot, &read, &rangeMasses]
+			{
+				if (!read) return;
+				snapshot.kineticEnergy = KineticEnergy(snapshot.points, simulation.Options().parameters, rangeMasses);
+			});
+		bool adaptive = simulation.Options().adaptiveTimeStep.enabled;
+		auto output = graph.Add([i, &snapshot, &read, dumpPoints, adaptive, first]
+			{
+				if (!read) return;
+				std::cout << "Iteration " << i << std::endl;
+				if (adaptive)
+				{
+					std::cout << std::format("Time step: {:.6g}, time: {:.6g}", snapshot.timeStep, snapshot.time) << std::endl;
+				}
+				std::cout << std::format("Kinetic energy: {:.9f}", snapshot.kineticEnergy) << std::endl;
+				DumpIterationResults(snapshot.points, snapshot.vertexes, dumpPoints, first);
+			});
+
+		graph.Precede(forces, advance);
+		graph.Precede(advance, readback);
+		graph.Precede(readback, statistics);
+		graph.Precede(statistics, output);
+		if (!fusedOutput)
+		{
+			auto vertex = graph.Add([&simulation, &snapshot, &read, first, count]
+				{
+					if (read) simulation.RunVertex(snapshot.vertexes, first, count);
+				});
+			graph.Precede(advance, vertex);
+			graph.Precede(vertex, output);
+			if (i > 1)
+			{
+				graph.Precede(outputs[i - 2], vertex);
+			}
+		}
+		if (i > 0)
+		{
+			graph.Precede(advances[i - 1], forces);
+			graph.Precede(readbacks[i - 1], forces);
+			graph.Precede(outputs[i - 1], output);
+		}
+		if (i > 1)
+		{
+			// The snapshot is written by the readback, or already by the fused step
+			graph.Precede(outputs[i - 2], fusedOutput ? advance : readback);
+		}
+
+		advances.push_back(advance);
+		readbacks.push_back(readback);
+		outputs.push_back(output);
+	}
+
+	graph.Run(pool);
+
+	// The last step is always read back
+	if (numIterations > 0)
+	{
+		points = snapshots[(numIterations - 1) % 2].points;
+		vertexes = snapshots[(numIterations - 1) % 2].vertexes;
+	}
+}
+
+void CreateInitialPoints(std::vector<Point>& points, std::vector<Vertex>& vertexes)
+{
+	for (size_t idx = 0; idx < points.size(); ++idx)
 	{
 		auto& point = points[idx];
 		point.position[0] = rand() % 100 / 100.0f;
@@ -615,26 +1001,742 @@ void run()
 		vertex.position[2] = point.position[0];
 		vertex.position[3] = 1.0f;
 	}
+}
+
+std::vector<float> CreatePointMasses(size_t count, const SimulationParameters& parameters, float spread)
+{
+	std::vector<float> masses;
+	if (spread == 0.0f) return masses;
+
+	masses.resize(count);
+	for (auto& mass : masses)
+	{
+		mass = parameters.mass * (1.0f + spread * (rand() % 201 - 100) / 100.0f);
+	}
+	return masses;
+}
+
+void DumpCpuConfiguration(const ThreadPool& pool, const CpuSimulation& simulation)
+{
+	const CpuSimulationOptions& options = simulation.Options();
+	std::cout << "CPU backend" << std::endl;
+	std::cout << "\tThreads: " << pool.ThreadCount() << std::endl;
+	std::cout << "\tKernel: " << simulation.Kernel().name << std::endl;
+	std::cout << "\tLayout: " << PointLayoutName(options.layout) << std::endl;
+	std::cout << std::format(
+		"\tParameters: k = {}, m = {}{}, r0 = {}, dt = {}",
+		options.parameters.springK,
+		options.parameters.mass,
+		simulation.HasPointMasses() ? " (per point)" : "",
+		options.parameters.restLength,
+		options.parameters.timeStep
+	) << std::endl;
+	if (options.order != CurveOrder::None)
+	{
+		std::cout << "\tOrder: " << CurveOrderName(options.order) << ", every " << options.reorderInterval << " steps" << std::endl;
+	}
+	std::cout << "\tForce law: " << ForceLawName(options.forceLaw) << std::endl;
+	switch (options.forceLaw)
+	{
+	case ForceLaw::LennardJones:
+		std::cout << std::format("\t\tepsilon = {}, sigma = {}", options.law.epsilon, options.law.sigma) << std::endl;
+		break;
+	case ForceLaw::Gravity:
+		std::cout << std::format("\t\tstrength = {}, softening = {}", options.law.strength, options.law.softening) << std::endl;
+		break;
+	case ForceLaw::Morse:
+		std::cout << std::format("\t\tdepth = {}, width = {}", options.law.depth, options.law.width) << std::endl;
+		break;
+	default:
+		break;
+	}
+	std::cout << "\tForces: " << ForceModeName(options.forceMode) << (options.deterministic ? ", deterministic" : "") << std::endl;
+	std::cout << "\tAccumulation: " << ForceAccumulationName(options.accumulation)
+		<< (options.halfPositions ? ", half precision positions" : "") << std::endl;
+	std::cout << "\tIntegrator: " << IntegratorName(options.integrator) << std::endl;
+	if (options.adaptiveTimeStep.enabled)
+	{
+		const AdaptiveTimeStep& adaptive = options.adaptiveTimeStep;
+		std::cout << std::format(
+			"\tAdaptive time step: accuracy {}, length {}, dt in [{}, {}]",
+			adaptive.accuracy,
+			adaptive.length,
+			adaptive.minTimeStep,
+			adaptive.maxTimeStep
+		) << std::endl;
+	}
+	if (options.blockTimeSteps.enabled)
+	{
+		const BlockTimeSteps& block = options.blockTimeSteps;
+		std::cout << std::format(
+			"\tBlock time steps: {} levels, accuracy {}, length {}",
+			block.levels,
+			block.accuracy,
+			block.length
+		) << std::endl;
+	}
+	if (options.cutoff > 0.0f)
+	{
+		std::cout << "\tCutoff: " << options.cutoff << std::endl;
+	}
+	if (options.forceMode == ForceMode::Verlet)
+	{
+		std::cout << "\tSkin: " << options.skin << std::endl;
+	}
+	if (options.forceMode == ForceMode::BarnesHut)
+	{
+		std::cout << "\tTheta: " << options.theta << std::endl;
+	}
+	std::cout << "\tTile: " << options.tileI << " x " << options.tileJ << std::endl;
+}
+
+void ReportForceError(ThreadPool& pool, const std::vector<Point>& points, const CpuSimulationOptions& options)
+{
+	// The reference sums in double from float positions, so it also shows the error of float
+	// sums and half positions
+	CpuSimulationOptions exactOptions = options;
+	exactOptions.forceMode = ForceMode::AllPairs;
+	exactOptions.accumulation = ForceAccumulation::Double;
+	exactOptions.halfPositions = false;
+
+	CpuSimulation simulation(pool, points, options);
+	CpuSimulation exact(pool, points, exactOptions);
+	simulation.RunCompute();
+	exact.RunCompute();
+
+	std::vector<float> forces;
+	std::vector<float> exactForces;
+	simulation.ReadBackForces(forces);
+	exact.ReadBackForces(exactForces);
+
+	// Relative to the RMS force, so points with almost no force do not dominate
+	double errorSum = 0.0;
+	double forceSum = 0.0;
+	double maxError = 0.0;
+	for (size_t index = 0; index < points.size(); ++index)
+	{
+		double error = 0.0;
+		double force = 0.0;
+		for (int c = 0; c < 3; ++c)
+		{
+			double difference = static_cast<double>(forces[index * 3 + c]) - exactForces[index * 3 + c];
+			error += difference * difference;
+			force += static_cast<double>(exactForces[index * 3 + c]) * exactForces[index * 3 + c];
+		}
+		errorSum += error;
+		forceSum += force;
+		maxError = std::max(maxError, error);
+	}
+
+	double rmsForce = std::sqrt(forceSum / std::max<size_t>(1, points.size()));
+	std::cout << std::format(
+		"Force error against all-pairs with double sums: {:.3e} RMS, {:.3e} max, relative to the RMS force {:.3e}",
+		std::sqrt(errorSum / forceSum),
+		std::sqrt(maxError) / rmsForce,
+		rmsForce
+	) << std::endl;
+}
+
+void RunCpuBenchmark(const RunOptions& options)
+{
+	std::vector<Point> points(options.benchmarkPoints);
+	std::vector<Vertex> vertexes(options.benchmarkPoints);
+	CreateInitialPoints(points, vertexes);
+	std::vector<float> masses = CreatePointMasses(points.size(), options.cpu.parameters, options.massSpread);
+
+	ThreadPool pool(options.threads);
+	CpuSimulation simulation(pool, points, options.cpu, masses);
+	DumpCpuConfiguration(pool, simulation);
+
+	// Warm up the caches and the worker threads
+	simulation.RunCompute();
+
+	double startTime = simulation.Time();
+	float minTimeStep = FLT_MAX;
+	float maxTimeStep = 0.0f;
+	std::vector<Point> outputPoints(points.size());
+	std::vector<Vertex> outputVertexes(points.size());
+
+	// Steps in batches of stepsPerIteration, each with only its last step read back and the
+	// workers kept awake for the steps before it
+	std::optional<ThreadPool::KeepAwake> awake;
+	auto start = std::chrono::steady_clock::now();
+	for (size_t step = 0; step < options.benchmarkSteps; ++step)
+	{
+		bool batchEnd = (step + 1) % options.stepsPerIteration == 0 || step + 1 == options.benchmarkSteps;
+		if (options.stepsPerIteration > 1 && step % options.stepsPerIteration == 0)
+		{
+			awake.emplace(pool);
+		}
+		if (batchEnd) awake.reset();
+
+		if (options.fused && batchEnd)
+		{
+			simulation.RunComputeFused(outputPoints, outputVertexes);
+		}
+		else
+		{
+			simulation.RunCompute();
+			if (options.benchmarkOutput && batchEnd)
+			{
+				simulation.ReadBackComputeResults(outputPoints);
+				simulation.RunVertex(outputVertexes);
+			}
+		}
+
+		minTimeStep = std::min(minTimeStep, simulation.TimeStep());
+		maxTimeStep = std::max(maxTimeStep, simulation.TimeStep());
+	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	double seconds = elapsed.count() / static_cast<double>(std::max<size_t>(1, options.benchmarkSteps));
+	double count = static_cast<double>(points.size());
+	std::cout << std::format(
+		"Benchmark: {} points, {} steps{}{}, {:.3f} ms/step, {:.3f} G interactions/s",
+		points.size(),
+		options.benchmarkSteps,
+		options.stepsPerIteration > 1 ? std::format(" in batches of {}", options.stepsPerIteration) : "",
+		options.fused ? " fused with readback and vertexes" : options.benchmarkOutput ? " with readback and vertexes" : "",
+		seconds * 1e3,
+		count * (count - 1) / seconds * 1e-9
+	) << std::endl;
+
+	if (options.cpu.adaptiveTimeStep.enabled && options.benchmarkSteps)
+	{
+		std::cout << std::format(
+			"Adaptive time step: {:.6g} simulated time, dt from {:.6g} to {:.6g}",
+			simulation.Time() - startTime,
+			minTimeStep,
+			maxTimeStep
+		) << std::endl;
+	}
+
+	if (const BlockTimeStepStats* stats = simulation.BlockStats())
+	{
+		std::string levelSteps;
+		for (size_t level = 0; level < options.cpu.blockTimeSteps.levels; ++level)
+		{
+			levelSteps += std::format("{}{}", level ? " " : "", stats->levelSteps[level]);
+		}
+		std::cout << std::format(
+			"Block time steps: {:.2f} force evaluations per point and step, {:.1f} sub-steps per step, steps per level {}",
+			static_cast<double>(stats->forcePoints) / std::max(1.0, count * static_cast<double>(stats->steps)),
+			static_cast<double>(stats->substeps) / std::max<size_t>(1, stats->steps),
+			levelSteps
+		) << std::endl;
+	}
+
+	if (const VerletListStats* stats = simulation.VerletStats())
+	{
+		std::cout << std::format(
+			"Verlet lists: {} rebuilds in {} steps, {:.1f} neighbors per point",
+			stats->rebuilds,
+			stats->steps,
+			static_cast<double>(stats->neighbors) / std::max(1.0, count)
+		) << std::endl;
+	}
+
+	if (options.forceError)
+	{
+		ReportForceError(pool, points, options.cpu);
+	}
+}
+
+// Systems of an ensemble run also run one by one, each in its own CpuSimulation
+const size_t ENSEMBLE_SAMPLE_SYSTEMS = 64;
+
+void RunEnsembleBenchmark(const RunOptions& options)
+{
+	if (options.cpu.forceLaw != ForceLaw::Spring || options.cpu.integrator != Integrator::Euler || options.massSpread > 0.0f)
+	{
+		throw std::invalid_argument("Ensembles only run the CSMain step: spring, Euler and one mass per system");
+	}
+
+	std::vector<std::vector<Point>> systems(options.ensembleSystems, std::vector<Point>(options.points));
+	std::vector<Vertex> vertexes(options.points);
+	for (auto& system : systems)
+	{
+		CreateInitialPoints(system, vertexes);
+	}
+
+	SimulationParameters to = options.cpu.parameters;
+	if (options.sweepSpringK) to.springK = *options.sweepSpringK;
+	if (options.sweepRestLength) to.restLength = *options.sweepRestLength;
+	if (options.sweepTimeStep) to.timeStep = *options.sweepTimeStep;
+	std::vector<SimulationParameters> parameters = SweepParameters(options.cpu.parameters, to, systems.size());
+
+	ThreadPool pool(options.threads);
+	CpuEnsemble ensemble(pool, systems, parameters, options.cpu.kernel, options.cpu.cutoff);
+
+	std::cout << std::format(
+		"Ensemble: {} systems of {} points, {} kernel ({} systems per vector), {} threads",
+		ensemble.SystemCount(),
+		ensemble.PointsCount(),
+		ensemble.Kernel().name,
+		ensemble.Kernel().width,
+		pool.ThreadCount()
+	) << std::endl;
+	std::cout << std::format(
+		"Sweep: k {} to {}, r0 {} to {}, dt {} to {}",
+		options.cpu.parameters.springK, to.springK,
+		options.cpu.parameters.restLength, to.restLength,
+		options.cpu.parameters.timeStep, to.timeStep
+	) << std::endl;
+
+	auto start = std::chrono::steady_clock::now();
+	ensemble.RunCompute(options.benchmarkSteps);
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	double count = static_cast<double>(options.points);
+	double systemSteps = static_cast<double>(systems.size()) * static_cast<double>(options.benchmarkSteps);
+	std::cout << std::format(
+		"Ensemble: {} steps, {:.3f} ms, {:.3f} M system steps/s, {:.3f} G interactions/s",
+		options.benchmarkSteps,
+		elapsed.count() * 1e3,
+		systemSteps / elapsed.count() * 1e-6,
+		systemSteps * count * (count - 1) / elapsed.count() * 1e-9
+	) << std::endl;
+
+	// The scalar kernel sums the pairs in the order of the ensemble kernel
+	CpuSimulationOptions single = options.cpu;
+	single.kernel = FindForceKernel("scalar");
+	single.forceMode = ForceMode::AllPairs;
+
+	size_t sampleCount = std::min(systems.size(), ENSEMBLE_SAMPLE_SYSTEMS);
+	float maxDifference = 0.0f;
+	std::vector<Point> expected;
+	std::vector<Point> actual;
+
+	start = std::chrono::steady_clock::now();
+	for (size_t system = 0; system < sampleCount; ++system)
+	{
+		single.parameters = parameters[system];
+		CpuSimulation simulation(pool, systems[system], single);
+		for (size_t step = 0; step < options.benchmarkSteps; ++step)
+		{
+			simulation.RunCompute();
+		}
+		simulation.ReadBackComputeResults(expected);
+
+		ensemble.ReadBackComputeResults(system, actual);
+		for (size_t idx = 0; idx < expected.size(); ++idx)
+		{
+			for (int c = 0; c < 3; ++c)
+			{
+				maxDifference = std::max(maxDifference, std::abs(actual[idx].position[c] - expected[idx].position[c]));
+				maxDifference = std::max(maxDifference, std::abs(actual[idx].velocity[c] - expected[idx].velocity[c]));
+			}
+		}
+	}
+	std::chrono::duration<double> sampleElapsed = std::chrono::steady_clock::now() - start;
+
+	if (sampleCount)
+	{
+		double sampleSteps = static_cast<double>(sampleCount) * static_cast<double>(options.benchmarkSteps);
+		std::cout << std::format(
+			"One CpuSimulation per system: {:.3f} M system steps/s on {} systems, largest difference {:.3e}",
+			sampleSteps / sampleElapsed.count() * 1e-6,
+			sampleCount,
+			maxDifference
+		) << std::endl;
+	}
+}
+
+void run(const RunOptions& options)
+{
+	if (options.ensembleSystems)
+	{
+		RunEnsembleBenchmark(options);
+		return;
+	}
+	if (options.benchmarkPoints)
+	{
+		RunCpuBenchmark(options);
+		return;
+	}
+
+	// Create initial point data
+	std::vector<Point> points(options.points);
+	std::vector<Vertex> vertexes(options.points);
+	CreateInitialPoints(points, vertexes);
+	std::vector<float> masses = CreatePointMasses(points.size(), options.cpu.parameters, options.massSpread);
+	ReadbackPolicy policy(options.readback, options.iterations, points.size());
+
+	if (options.backend == Backend::Cpu)
+	{
+		ThreadPool pool(options.threads);
+		CpuSimulation simulation(pool, points, options.cpu, masses);
+		DumpCpuConfiguration(pool, simulation);
+
+		CpuComputeLoop(pool, simulation, points, vertexes, masses, options.iterations, options.stepsPerIteration,
+			options.dumpPoints, options.fused, policy, options.snapshotSteps);
+		return;
+	}
+
+	if (options.cpu.forceLaw != ForceLaw::Spring)
+	{
+		throw std::invalid_argument("The GPU backend only has the spring force law, use --backend=cpu");
+	}
+	if (options.cpu.integrator != Integrator::Euler)
+	{
+		throw std::invalid_argument("The GPU backend only has the Euler integrator, use --backend=cpu");
+	}
+	if (options.cpu.adaptiveTimeStep.enabled || options.cpu.blockTimeSteps.enabled)
+	{
+		throw std::invalid_argument("The GPU backend only has a fixed time step, use --backend=cpu");
+	}
+
+#ifdef _WIN32
+	HWND hWnd = nullptr;
+
+	// Initialize Direct3D
+	InitD3D(hWnd);
 
 	// Create buffers for point data
 	CreateComputeBuffers(points);
+	CreateParameterBuffers(options.cpu.parameters, masses);
 	CreateVertexBuffers(vertexes);
 
 	// Run the compute shader loop
-	ComputeLoop(points, vertexes, 5);
+	ComputeLoop(points, vertexes, options.iterations, options.stepsPerIteration, options.dumpPoints,
+		options.readbackFrames, policy, options.snapshotSteps);
 
 	// Cleanup
 	Cleanup();
+#else
+	throw std::runtime_error("GPU backend requires Direct3D 11, use --backend=cpu");
+#endif
+}
+
+// Matches "--name=value" and returns the value
+bool MatchOption(std::string_view arg, std::string_view name, std::string_view& value)
+{
+	if (!arg.starts_with(name) || arg.size() <= name.size() || arg[name.size()] != '=') return false;
+
+	value = arg.substr(name.size() + 1);
+	return true;
+}
+
+size_t ParseCount(std::string_view value)
+{
+	size_t result = 0;
+	auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), result);
+	if (error != std::errc() || end != value.data() + value.size())
+	{
+		throw std::invalid_argument(std::format("Not a count: {}", value));
+	}
+	return result;
+}
+
+float ParseFloat(std::string_view value)
+{
+	float result = 0.0f;
+	auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), result);
+	if (error != std::errc() || end != value.data() + value.size())
+	{
+		throw std::invalid_argument(std::format("Not a number: {}", value));
+	}
+	return result;
+}
+
+RunOptions ParseCommandLine(int argc, char* argv[])
+{
+	RunOptions options;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string_view arg = argv[i];
+		std::string_view value;
+
+		if (MatchOption(arg, "--backend", value))
+		{
+			if (value == "gpu") options.backend = Backend::Gpu;
+			else if (value == "cpu") options.backend = Backend::Cpu;
+			else throw std::invalid_argument(std::format("Unknown backend: {}", value));
+		}
+		else if (MatchOption(arg, "--points", value))
+		{
+			options.points = ParseCount(value);
+		}
+		else if (MatchOption(arg, "--dump-points", value))
+		{
+			options.dumpPoints = ParseCount(value);
+		}
+		else if (MatchOption(arg, "--threads", value))
+		{
+			options.threads = ParseCount(value);
+		}
+		else if (MatchOption(arg, "--readback-frames", value))
+		{
+			options.readbackFrames = ParseCount(value);
+		}
+		else if (MatchOption(arg, "--iterations", value))
+		{
+			options.iterations = static_cast<int>(std::min<size_t>(ParseCount(value), INT_MAX));
+		}
+		else if (MatchOption(arg, "--steps-per-iteration", value))
+		{
+			options.stepsPerIteration = ParseCount(value);
+			if (options.stepsPerIteration == 0)
+			{
+				throw std::invalid_argument("--steps-per-iteration must be at least 1");
+			}
+		}
+		else if (MatchOption(arg, "--readback", value))
+		{
+			if (value == "interval") options.readback.mode = ReadbackMode::Interval;
+			else if (value == "on-demand") options.readback.mode = ReadbackMode::OnDemand;
+			else if (value == "end") options.readback.mode = ReadbackMode::End;
+			else throw std::invalid_argument(std::format("Unknown readback mode: {}", value));
+		}
+		else if (MatchOption(arg, "--readback-interval", value))
+		{
+			options.readback.interval = ParseCount(value);
+		}
+		else if (MatchOption(arg, "--readback-first", value))
+		{
+			options.readback.first = ParseCount(value);
+		}
+		else if (MatchOption(arg, "--readback-count", value))
+		{
+			options.readback.count = ParseCount(value);
+		}
+		else if (MatchOption(arg, "--snapshots", value))
+		{
+			// Comma-separated steps
+			options.snapshotSteps.clear();
+			for (size_t start = 0; start <= value.size();)
+			{
+				size_t end = std::min(value.find(',', start), value.size());
+				options.snapshotSteps.push_back(ParseCount(value.substr(start, end - start)));
+				start = end + 1;
+			}
+		}
+		else if (MatchOption(arg, "--kernel", value))
+		{
+			options.cpu.kernel = FindForceKernel(value);
+			if (!options.cpu.kernel)
+			{
+				throw std::invalid_argument(std::format("Force kernel is not available on this CPU: {}", value));
+			}
+		}
+		else if (MatchOption(arg, "--layout", value))
+		{
+			if (value == "aos") options.cpu.layout = PointLayout::Aos;
+			else if (value == "soa") options.cpu.layout = PointLayout::Soa;
+			else if (value == "aosoa8") options.cpu.layout = PointLayout::Aosoa8;
+			else if (value == "aosoa16") options.cpu.layout = PointLayout::Aosoa16;
+			else throw std::invalid_argument(std::format("Unknown point layout: {}", value));
+		}
+		else if (MatchOption(arg, "--order", value))
+		{
+			if (value == "none") options.cpu.order = CurveOrder::None;
+			else if (value == "morton") options.cpu.order = CurveOrder::Morton;
+			else if (value == "hilbert") options.cpu.order = CurveOrder::Hilbert;
+			else throw std::invalid_argument(std::format("Unknown point order: {}", value));
+		}
+		else if (MatchOption(arg, "--reorder-interval", value))
+		{
+			options.cpu.reorderInterval = ParseCount(value);
+		}
+		else if (MatchOption(arg, "--forces", value))
+		{
+			if (value == "all-pairs") options.cpu.forceMode = ForceMode::AllPairs;
+			else if (value == "symmetric") options.cpu.forceMode = ForceMode::Symmetric;
+			else if (value == "cell-list") options.cpu.forceMode = ForceMode::CellList;
+			else if (value == "verlet") options.cpu.forceMode = ForceMode::Verlet;
+			else if (value == "centroid") options.cpu.forceMode = ForceMode::Centroid;
+			else if (value == "barnes-hut") options.cpu.forceMode = ForceMode::BarnesHut;
+			else throw std::invalid_argument(std::format("Unknown force mode: {}", value));
+		}
+		else if (MatchOption(arg, "--k", value))
+		{
+			options.cpu.parameters.springK = ParseFloat(value);
+		}
+		else if (MatchOption(arg, "--mass", value))
+		{
+			options.cpu.parameters.mass = ParseFloat(value);
+		}
+		else if (MatchOption(arg, "--rest-length", value))
+		{
+			options.cpu.parameters.restLength = ParseFloat(value);
+		}
+		else if (MatchOption(arg, "--dt", value))
+		{
+			options.cpu.parameters.timeStep = ParseFloat(value);
+		}
+		else if (MatchOption(arg, "--mass-spread", value))
+		{
+			options.massSpread = ParseFloat(value);
+			if (!(options.massSpread >= 0.0f && options.massSpread < 1.0f))
+			{
+				throw std::invalid_argument(std::format("Mass spread must be in [0, 1): {}", value));
+			}
+		}
+		else if (MatchOption(arg, "--force-law", value))
+		{
+			if (value == "spring") options.cpu.forceLaw = ForceLaw::Spring;
+			else if (value == "lennard-jones") options.cpu.forceLaw = ForceLaw::LennardJones;
+			else if (value == "gravity") options.cpu.forceLaw = ForceLaw::Gravity;
+			else if (value == "morse") options.cpu.forceLaw = ForceLaw::Morse;
+			else if (value == "user") options.cpu.forceLaw = ForceLaw::User;
+			else throw std::invalid_argument(std::format("Unknown force law: {}", value));
+		}
+		else if (MatchOption(arg, "--epsilon", value))
+		{
+			options.cpu.law.epsilon = ParseFloat(value);
+		}
+		else if (MatchOption(arg, "--sigma", value))
+		{
+			options.cpu.law.sigma = ParseFloat(value);
+		}
+		else if (MatchOption(arg, "--strength", value))
+		{
+			options.cpu.law.strength = ParseFloat(value);
+		}
+		else if (MatchOption(arg, "--softening", value))
+		{
+			options.cpu.law.softening = ParseFloat(value);
+		}
+		else if (MatchOption(arg, "--depth", value))
+		{
+			options.cpu.law.depth = ParseFloat(value);
+		}
+		else if (MatchOption(arg, "--width", value))
+		{
+			options.cpu.law.width = ParseFloat(value);
+		}
+		else if (MatchOption(arg, "--integrator", value))
+		{
+			if (value == "euler") options.cpu.integrator = Integrator::Euler;
+			else if (value == "leapfrog") options.cpu.integrator = Integrator::Leapfrog;
+			else if (value == "velocity-verlet") options.cpu.integrator = Integrator::VelocityVerlet;
+			else if (value == "rk4") options.cpu.integrator = Integrator::Rk4;
+			else throw std::invalid_argument(std::format("Unknown integrator: {}", value));
+		}
+		else if (arg == "--adaptive-dt")
+		{
+			options.cpu.adaptiveTimeStep.enabled = true;
+		}
+		else if (MatchOption(arg, "--dt-accuracy", value))
+		{
+			options.cpu.adaptiveTimeStep.accuracy = ParseFloat(value);
+		}
+		else if (MatchOption(arg, "--dt-length", value))
+		{
+			options.cpu.adaptiveTimeStep.length = ParseFloat(value);
+		}
+		else if (MatchOption(arg, "--dt-min", value))
+		{
+			options.cpu.adaptiveTimeStep.minTimeStep = ParseFloat(value);
+		}
+		else if (MatchOption(arg, "--dt-max", value))
+		{
+			options.cpu.adaptiveTimeStep.maxTimeStep = ParseFloat(value);
+		}
+		else if (MatchOption(arg, "--block-levels", value))
+		{
+			options.cpu.blockTimeSteps.enabled = true;
+			options.cpu.blockTimeSteps.levels = ParseCount(value);
+		}
+		else if (MatchOption(arg, "--block-accuracy", value))
+		{
+			options.cpu.blockTimeSteps.accuracy = ParseFloat(value);
+		}
+		else if (MatchOption(arg, "--block-length", value))
+		{
+			options.cpu.blockTimeSteps.length = ParseFloat(value);
+		}
+		else if (MatchOption(arg, "--cutoff", value))
+		{
+			options.cpu.cutoff = ParseFloat(value);
+		}
+		else if (MatchOption(arg, "--skin", value))
+		{
+			options.cpu.skin = ParseFloat(value);
+		}
+		else if (MatchOption(arg, "--theta", value))
+		{
+			options.cpu.theta = ParseFloat(value);
+		}
+		else if (MatchOption(arg, "--tile-i", value))
+		{
+			options.cpu.tileI = ParseCount(value);
+		}
+		else if (MatchOption(arg, "--tile-j", value))
+		{
+			options.cpu.tileJ = ParseCount(value);
+		}
+		else if (MatchOption(arg, "--benchmark", value))
+		{
+			options.benchmarkPoints = ParseCount(value);
+			options.backend = Backend::Cpu;
+		}
+		else if (MatchOption(arg, "--benchmark-steps", value))
+		{
+			options.benchmarkSteps = ParseCount(value);
+		}
+		else if (MatchOption(arg, "--ensemble", value))
+		{
+			options.ensembleSystems = ParseCount(value);
+			options.backend = Backend::Cpu;
+		}
+		else if (MatchOption(arg, "--sweep-k", value))
+		{
+			options.sweepSpringK = ParseFloat(value);
+		}
+		else if (MatchOption(arg, "--sweep-rest-length", value))
+		{
+			options.sweepRestLength = ParseFloat(value);
+		}
+		else if (MatchOption(arg, "--sweep-dt", value))
+		{
+			options.sweepTimeStep = ParseFloat(value);
+		}
+		else if (MatchOption(arg, "--accumulation", value))
+		{
+			if (value == "float") options.cpu.accumulation = ForceAccumulation::Float;
+			else if (value == "kahan") options.cpu.accumulation = ForceAccumulation::Kahan;
+			else if (value == "double") options.cpu.accumulation = ForceAccumulation::Double;
+			else throw std::invalid_argument(std::format("Unknown accumulation: {}", value));
+		}
+		else if (arg == "--half-positions")
+		{
+			options.cpu.halfPositions = true;
+		}
+		else if (arg == "--fused")
+		{
+			options.fused = true;
+		}
+		else if (arg == "--benchmark-output")
+		{
+			options.benchmarkOutput = true;
+		}
+		else if (arg == "--deterministic")
+		{
+			options.cpu.deterministic = true;
+		}
+		else if (arg == "--force-error")
+		{
+			options.forceError = true;
+		}
+		else
+		{
+			throw std::invalid_argument(std::format("Unknown argument: {}", arg));
+		}
+	}
+
+	return options;
 }
 
-int main()
+int main(int argc, char* argv[])
 {
 	std::cout << "Hello World" << std::endl;
 	std::cout << "Working in: " << std::filesystem::current_path() << std::endl;
 
 	try
 	{
-		run();
+		run(ParseCommandLine(argc, argv));
 	}
 	catch (const std::exception& e)
 	{
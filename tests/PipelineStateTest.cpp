@@ -0,0 +1,253 @@
+﻿// Tests of PipelineState against a context that records the call stream and models the D3D11
+// rules the layer relies on, no GPU needed. From this directory:
+//   g++ -std=c++20 -I.. PipelineStateTest.cpp ../PipelineState.cpp -o PipelineStateTest && ./PipelineStateTest
+
+#include "PipelineState.h"
+
+#include <array>
+#include <cstdio>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace
+{
+	int g_failures = 0;
+
+	void Check(bool condition, const char* what)
+	{
+		if (!condition)
+		{
+			std::printf("FAILED: %s\n", what);
+			++g_failures;
+		}
+	}
+
+	// Keeps the bindings like a device context. Checks after every call that no buffer is an
+	// input and an output at once, and, like D3D11, makes a draw append to the stream output
+	// target after the previous draw unless the target was bound again in between.
+	class RecordingContext : public PipelineContext
+	{
+	public:
+		void AddView(GpuView view, GpuBuffer resource) { m_resources[view] = resource; }
+
+		void SetShader(ShaderStage stage, GpuShader) override
+		{
+			Record(stage == ShaderStage::Compute ? "CSSetShader" : "VSSetShader");
+		}
+
+		void SetShaderResource(ShaderStage stage, size_t slot, GpuView view) override
+		{
+			m_resourceViews[static_cast<size_t>(stage)][slot] = view;
+			Record(stage == ShaderStage::Compute ? "CSSetShaderResources" : "VSSetShaderResources");
+		}
+
+		void SetConstantBuffer(ShaderStage stage, size_t, GpuBuffer) override
+		{
+			Record(stage == ShaderStage::Compute ? "CSSetConstantBuffers" : "VSSetConstantBuffers");
+		}
+
+		void SetUnorderedAccess(size_t slot, GpuView view) override
+		{
+			m_unorderedAccess[slot] = view;
+			Record("CSSetUnorderedAccessViews");
+		}
+
+		void SetStreamOutput(GpuBuffer buffer) override
+		{
+			m_streamOutput = buffer;
+			m_streamOffset = 0;
+			Record("SOSetTargets");
+		}
+
+		void Dispatch(size_t, size_t) override { Record("Dispatch"); }
+
+		void Draw(size_t count, size_t) override
+		{
+			drawOffsets.push_back(m_streamOffset);
+			m_streamOffset += count;
+			Record("Draw");
+		}
+
+		bool NothingBound() const
+		{
+			for (const auto& views : m_resourceViews)
+			{
+				for (GpuView view : views)
+				{
+					if (view) return false;
+				}
+			}
+			for (GpuView view : m_unorderedAccess)
+			{
+				if (view) return false;
+			}
+			return !m_streamOutput;
+		}
+
+		std::vector<std::string> calls;
+		std::vector<size_t> drawOffsets; // Stream output offset every draw started at
+
+	private:
+		void Record(const char* call)
+		{
+			calls.push_back(call);
+
+			for (const auto& views : m_resourceViews)
+			{
+				for (GpuView input : views)
+				{
+					if (!input) continue;
+					GpuBuffer resource = m_resources.at(input);
+					Check(resource != m_streamOutput, "no buffer is a shader resource and stream output target");
+					for (GpuView output : m_unorderedAccess)
+					{
+						Check(!output || m_resources.at(output) != resource,
+							"no buffer is a shader resource and an unordered access view");
+					}
+				}
+			}
+		}
+
+		std::map<GpuView, GpuBuffer> m_resources;
+		std::array<std::array<GpuView, PIPELINE_SLOTS>, SHADER_STAGE_COUNT> m_resourceViews = {};
+		std::array<GpuView, PIPELINE_SLOTS> m_unorderedAccess = {};
+		GpuBuffer m_streamOutput = nullptr;
+		size_t m_streamOffset = 0;
+	};
+
+	// Distinct handles for the mock
+	std::array<int, 16> g_objects;
+
+	void* Handle(size_t index) { return &g_objects[index]; }
+
+	// The bindings of ComputeLoop: K compute steps that ping-pong between buffers A and B, then
+	// the vertex shader on the last output into the stream output target
+	void TestComputeLoop(size_t stepsPerIteration)
+	{
+		GpuShader computeShader = Handle(0);
+		GpuShader vertexShader = Handle(1);
+		GpuBuffer bufferA = Handle(2);
+		GpuBuffer bufferB = Handle(3);
+		GpuBuffer masses = Handle(4);
+		GpuBuffer parameters = Handle(5);
+		GpuBuffer vertexOutput = Handle(6);
+
+		RecordingContext context;
+		BoundView readSRV = { Handle(7), bufferA };
+		BoundView writeSRV = { Handle(8), bufferB };
+		BoundView readUAV = { Handle(9), bufferA };
+		BoundView writeUAV = { Handle(10), bufferB };
+		BoundView massesSRV = { Handle(11), masses };
+		for (const BoundView& view : { readSRV, writeSRV, readUAV, writeUAV, massesSRV })
+		{
+			context.AddView(view.view, view.resource);
+		}
+
+		PipelineState state(context);
+		std::vector<size_t> iterationCalls;
+		const size_t pointCount = 100;
+		for (int iteration = 0; iteration < 4; ++iteration)
+		{
+			state.ResetCounts();
+			for (size_t step = 0; step < stepsPerIteration; ++step)
+			{
+				state.SetShader(ShaderStage::Compute, computeShader);
+				state.SetShaderResource(ShaderStage::Compute, 0, readSRV);
+				state.SetShaderResource(ShaderStage::Compute, 1, massesSRV);
+				state.SetUnorderedAccess(0, writeUAV);
+				state.SetConstantBuffer(ShaderStage::Compute, 0, parameters);
+				state.Dispatch(1, 1);
+
+				std::swap(readSRV, writeSRV);
+				std::swap(readUAV, writeUAV);
+			}
+
+			state.SetShader(ShaderStage::Vertex, vertexShader);
+			state.SetShaderResource(ShaderStage::Vertex, 0, readSRV);
+			state.SetStreamOutput(vertexOutput);
+			state.Draw(pointCount, 0);
+			iterationCalls.push_back(state.Calls());
+		}
+
+		// Every iteration writes its vertexes from the start of the target
+		Check(context.drawOffsets.size() == 4, "one draw per iteration");
+		for (size_t offset : context.drawOffsets)
+		{
+			Check(offset == 0, "every draw starts at stream output offset 0");
+		}
+
+		// First iteration: 8 binds, the dispatch and the draw, and the unbind of the UAV the
+		// vertex shader reads. Later ones only bind the point buffer views, again with that
+		// unbind, and the stream output target. Every extra step unbinds the UAV it reads, and
+		// the second step also the vertex shader input of the iteration before.
+		size_t extraSteps = stepsPerIteration - 1;
+		Check(iterationCalls[0] == 11 + 4 * extraSteps, "calls of the first iteration");
+		for (size_t iteration = 1; iteration < iterationCalls.size(); ++iteration)
+		{
+			Check(iterationCalls[iteration] == 7 + 4 * extraSteps + (extraSteps ? 1 : 0), "calls of a later iteration");
+		}
+
+		state.Clear();
+		Check(context.NothingBound(), "Clear unbinds everything");
+	}
+
+	// A buffer moving between shader resource, unordered access view and stream output target
+	void TestHazards()
+	{
+		GpuBuffer buffer = Handle(12);
+		BoundView srv = { Handle(13), buffer };
+		BoundView uav = { Handle(14), buffer };
+
+		RecordingContext context;
+		context.AddView(srv.view, buffer);
+		context.AddView(uav.view, buffer);
+		PipelineState state(context);
+
+		state.SetStreamOutput(buffer);
+		state.SetShaderResource(ShaderStage::Vertex, 2, srv);
+		state.SetUnorderedAccess(1, uav);
+		state.SetStreamOutput(buffer);
+		std::vector<std::string> expected = {
+			"SOSetTargets",
+			"SOSetTargets", "VSSetShaderResources",
+			"VSSetShaderResources", "CSSetUnorderedAccessViews",
+			"CSSetUnorderedAccessViews", "SOSetTargets"
+		};
+		Check(context.calls == expected, "one unbind per hazard");
+
+		// Binding what is bound is skipped, except for the stream output target
+		size_t calls = context.calls.size();
+		state.SetShaderResource(ShaderStage::Vertex, 2, {});
+		state.SetUnorderedAccess(1, {});
+		Check(context.calls.size() == calls, "unbinding what is not bound is skipped");
+		state.SetStreamOutput(buffer);
+		Check(context.calls.size() == calls + 1, "the stream output target is bound again");
+	}
+
+	void TestErrors()
+	{
+		RecordingContext context;
+		PipelineState state(context);
+		try
+		{
+			state.SetUnorderedAccess(PIPELINE_SLOTS, {});
+			Check(false, "slot out of range throws");
+		}
+		catch (const std::invalid_argument&)
+		{
+		}
+	}
+}
+
+int main()
+{
+	TestComputeLoop(1);
+	TestComputeLoop(3);
+	TestHazards();
+	TestErrors();
+
+	std::printf(g_failures ? "%d checks failed\n" : "All checks passed\n", g_failures);
+	return g_failures ? 1 : 0;
+}
@@ -0,0 +1,210 @@
+﻿// Tests of ReadbackRing against a stand-in StagingContext, no GPU needed. From this directory:
+//   g++ -std=c++20 -I.. ReadbackRingTest.cpp ../ReadbackRing.cpp -o ReadbackRingTest && ./ReadbackRingTest
+
+#include "ReadbackRing.h"
+
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+namespace
+{
+	int g_failures = 0;
+
+	void Check(bool condition, const char* what)
+	{
+		if (!condition)
+		{
+			std::printf("FAILED: %s\n", what);
+			++g_failures;
+		}
+	}
+
+	// Buffers in host memory; a copy is only finished after latency polls of Map without wait
+	class FakeStagingContext : public StagingContext
+	{
+	public:
+		explicit FakeStagingContext(int latency) : m_latency(latency) {}
+
+		GpuBuffer Source(size_t size)
+		{
+			return NewBuffer(size);
+		}
+
+		std::vector<char>& Data(GpuBuffer buffer) { return m_buffers.at(buffer)->data; }
+
+		GpuBuffer CreateStagingBuffer(GpuBuffer, size_t size) override
+		{
+			++created;
+			return NewBuffer(size);
+		}
+
+		void ReleaseBuffer(GpuBuffer buffer) override
+		{
+			Check(!m_buffers.at(buffer)->mapped, "released buffer is not mapped");
+			++released;
+		}
+
+		size_t BufferSize(GpuBuffer buffer) override { return Data(buffer).size(); }
+
+		void CopyBuffer(GpuBuffer staging, GpuBuffer source, const BufferRange& range) override
+		{
+			const std::vector<char>& from = Data(source);
+			Buffer& to = *m_buffers.at(staging);
+			Check(range.offset + range.size <= from.size(), "copy within the source");
+			Check(range.size == to.data.size(), "copy fills the staging buffer");
+			to.data.assign(from.begin() + range.offset, from.begin() + range.offset + range.size);
+			to.pending = m_latency;
+		}
+
+		const void* Map(GpuBuffer staging, bool wait) override
+		{
+			Buffer& buffer = *m_buffers.at(staging);
+			Check(!buffer.mapped, "map of a buffer that is not mapped");
+			if (!wait && buffer.pending > 0)
+			{
+				--buffer.pending;
+				return nullptr;
+			}
+			buffer.pending = 0;
+			buffer.mapped = true;
+			return buffer.data.data();
+		}
+
+		void Unmap(GpuBuffer staging) override
+		{
+			Buffer& buffer = *m_buffers.at(staging);
+			Check(buffer.mapped, "unmap of a mapped buffer");
+			buffer.mapped = false;
+		}
+
+		int created = 0;
+		int released = 0;
+
+	private:
+		struct Buffer
+		{
+			std::vector<char> data;
+			int pending = 0;
+			bool mapped = false;
+		};
+
+		GpuBuffer NewBuffer(size_t size)
+		{
+			auto buffer = std::make_unique<Buffer>();
+			buffer->data.resize(size);
+			GpuBuffer handle = buffer.get();
+			m_buffers[handle] = std::move(buffer);
+			return handle;
+		}
+
+		int m_latency;
+		std::map<GpuBuffer, std::unique_ptr<Buffer>> m_buffers;
+	};
+
+	// Every frame is read back whole and in order, however long the copies take
+	void TestOrder(int latency)
+	{
+		FakeStagingContext context(latency);
+		GpuBuffer points = context.Source(8);
+		GpuBuffer vertexes = context.Source(4);
+		{
+			ReadbackRing ring(context, { points, vertexes }, 3);
+			Check(context.created == 6 && ring.Slots() == 3, "one staging buffer per slot and source");
+
+			int readPoints[2] = {};
+			char readVertexes[4] = {};
+			std::vector<void*> destinations = { readPoints, readVertexes };
+			int collected = 0;
+			auto checkOldest = [&](bool wait)
+				{
+					int frame = static_cast<int>(ring.Oldest());
+					if (!ring.Collect(destinations, wait)) return false;
+					Check(frame == collected, "frames are collected in order");
+					Check(readPoints[0] == frame && readPoints[1] == frame * frame, "point data of the frame");
+					Check(readVertexes[0] == static_cast<char>(frame), "vertex data of the frame");
+					++collected;
+					return true;
+				};
+
+			for (int frame = 0; frame < 10; ++frame)
+			{
+				int values[2] = { frame, frame * frame };
+				std::memcpy(context.Data(points).data(), values, sizeof(values));
+				context.Data(vertexes)[0] = static_cast<char>(frame);
+
+				if (ring.Full()) Check(checkOldest(true), "waiting collect succeeds");
+				ring.Submit({ points, vertexes });
+				while (ring.InFlight() && checkOldest(false))
+				{
+				}
+			}
+			while (ring.InFlight()) Check(checkOldest(true), "drain succeeds");
+			Check(collected == 10, "every frame collected");
+			Check(!ring.Collect(destinations, true), "nothing to collect from an empty ring");
+
+			// A full ring drops its oldest frame
+			for (int frame = 0; frame < 4; ++frame) ring.Submit({ points, vertexes });
+			Check(ring.InFlight() == 3 && ring.Oldest() == 11, "oldest frame dropped");
+			Check(context.created == 6, "no staging buffers created after construction");
+		}
+		Check(context.released == 6, "every staging buffer released");
+	}
+
+	void TestRanges()
+	{
+		FakeStagingContext context(1);
+		GpuBuffer points = context.Source(8);
+		GpuBuffer vertexes = context.Source(4);
+
+		// The second int only, and the whole vertex buffer
+		ReadbackRing ring(context, { points, vertexes }, 2, { { 4, 4 }, { 0, 4 } });
+		int value = 49;
+		std::memcpy(context.Data(points).data() + 4, &value, sizeof(value));
+		ring.Submit({ points, vertexes });
+
+		int readPoint = 0;
+		char readVertexes[4] = {};
+		Check(ring.Collect({ &readPoint, readVertexes }, true) && readPoint == 49, "range read back");
+	}
+
+	void TestErrors()
+	{
+		FakeStagingContext context(0);
+		GpuBuffer points = context.Source(8);
+
+		try
+		{
+			ReadbackRing ring(context, { points }, 0);
+			Check(false, "no slots throws");
+		}
+		catch (const std::invalid_argument&)
+		{
+		}
+
+		try
+		{
+			ReadbackRing ring(context, { points }, 1, { { 4, 8 } });
+			Check(false, "range past the end throws");
+		}
+		catch (const std::invalid_argument&)
+		{
+		}
+	}
+}
+
+int main()
+{
+	for (int latency = 0; latency < 3; ++latency)
+	{
+		TestOrder(latency);
+	}
+	TestRanges();
+	TestErrors();
+
+	std::printf(g_failures ? "%d checks failed\n" : "All checks passed\n", g_failures);
+	return g_failures ? 1 : 0;
+}